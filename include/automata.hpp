@@ -8,36 +8,99 @@
 #include <unordered_set>
 
 #include "utility.hpp"
-#include "reg_graph.hpp"
+#include "program.hpp"
+#include "simulation.hpp"
 
 
-class Automata {
+using MatchResult = std::optional<std::pair<size_t, size_t>>;
+
+// the mutable state of a match, reusing one scratch across matches avoids
+// allocating on every match, a scratch must not be shared between threads
+class MatchScratch {
 private:
+  friend class Automata;
+  friend class Regex;
+  friend class RegexSet;
+
+  static constexpr uint32_t NO_LOOP = UINT32_MAX;
+
+  // loop counters form a stack per path, frames of all stacks are kept in
+  // one arena and point to the frame of the enclosing loop
+  struct LoopFrame {
+    uint32_t parent;
+    size_t count;
+  };
+
   struct StackElem {
     size_t offset;
-    RegGraph::NodePtr node;
+    uint32_t node;
     size_t index;
-    std::vector<size_t> loop;
+    uint32_t loop;
+    // size of the loop arena when the element was pushed
+    size_t loop_size;
     size_t match_start;
     bool finish{false};
   };
 
-  RegGraph &graph;
-  std::string_view input;
   std::vector<StackElem> stack;
-  std::optional<std::pair<size_t, size_t>> best_match;
+  std::vector<LoopFrame> loops;
+  // best match of every pattern of the program
+  std::vector<MatchResult> matches;
+  // the state of the engines stepping the input
+  Simulation simulation;
+
+public:
+  MatchScratch() : stack{}, loops{}, matches{}, simulation{} {}
+};
+
+class Automata {
+private:
+  using StackElem = MatchScratch::StackElem;
+  using LoopFrame = MatchScratch::LoopFrame;
+
+  const Program &program;
+  std::string_view input;
+  std::vector<StackElem> &stack;
+  std::vector<LoopFrame> &loops;
+  std::vector<MatchResult> &best_match;
   bool debug;
 
-  Automata(RegGraph &graph, std::string_view input) :
-      graph{graph}, input{input}, stack{}, best_match{std::nullopt},
-      debug{false}
-  {
-    debug =
+  static bool debug_enabled() {
+    static const bool debug =
         std::getenv("REGEX_DEBUG") != nullptr ||
         std::getenv("REGEX_AUTOMATA_DEBUG") != nullptr;
+    return debug;
+  }
+
+  Automata(
+      const Program &program, std::string_view input, MatchScratch &scratch
+  ) :
+      program{program}, input{input}, stack{scratch.stack},
+      loops{scratch.loops}, best_match{scratch.matches},
+      debug{debug_enabled()}
+  {
+    stack.clear();
+    loops.clear();
+    best_match.assign(program.pattern_size(), std::nullopt);
+  }
+
+  void push(size_t offset, uint32_t node, uint32_t loop, size_t match_start) {
+    stack.emplace_back(StackElem{
+      .offset = offset,
+      .node = node,
+      .index = 0,
+      .loop = loop,
+      .loop_size = loops.size(),
+      .match_start = match_start,
+    });
+  }
+
+  uint32_t push_loop(uint32_t parent, size_t count) {
+    loops.emplace_back(LoopFrame{.parent = parent, .count = count});
+    return loops.size() - 1;
   }
 
-  void set_match(size_t begin, size_t end) {
+  void set_match(size_t begin, size_t end, uint32_t pattern) {
     if (regex_unlikely(debug)) {
       std::cout
           << "match: " << begin << ", " << end
@@ -46,29 +109,58 @@ private:
           << std::endl;
     }
 
-    if (best_match) {
-      auto &[best_match_start, best_match_end] = best_match.value();
+    auto &match = best_match[pattern];
+
+    if (match) {
+      auto &[best_match_start, best_match_end] = match.value();
 
       if (end - begin > best_match_end - best_match_start) {
-        best_match = std::make_pair(begin, end);
+        match = std::make_pair(begin, end);
       } else if (
           end - begin == best_match_end - best_match_start &&
           begin < best_match_start
       ) {
-        best_match = std::make_pair(begin, end);
+        match = std::make_pair(begin, end);
       }
     } else {
-      best_match = std::make_pair(begin, end);
+      match = std::make_pair(begin, end);
     }
 
   }
 
-  std::optional<std::pair<size_t, size_t>> run();
+  // take the edge from the top element if it accepts the input there
+  void step_edge(const ProgramEdge &edge);
+
+  // LONGEST tries every path and keeps the best match of every pattern.
+  // LEFTMOST_FIRST tries match attempts from the left and stops at the
+  // first path reaching an accepting MATCH_END in the order of the edges,
+  // ANY stops there too. Returns whether the search stopped at a match
+  bool run(MatchPolicy policy);
 
 public:
-  static std::optional<std::pair<size_t, size_t>>
-  accept(RegGraph &graph, std::string_view input) {
-    return Automata{graph, input}.run();
+  // the match under the semantics of the program
+  static MatchResult accept(
+      const Program &program, std::string_view input, MatchScratch &scratch
+  ) {
+    Automata{program, input, scratch}.run(
+        program.semantics() == MatchSemantics::LEFTMOST_FIRST ?
+            MatchPolicy::LEFTMOST_FIRST : MatchPolicy::LONGEST
+    );
+    return scratch.matches[0];
+  }
+
+  static bool accept_any(
+      const Program &program, std::string_view input, MatchScratch &scratch
+  ) {
+    return Automata{program, input, scratch}.run(MatchPolicy::ANY);
+  }
+
+  // the best match of every pattern is left in the scratch
+  static const std::vector<MatchResult> &accept_all(
+      const Program &program, std::string_view input, MatchScratch &scratch
+  ) {
+    Automata{program, input, scratch}.run(MatchPolicy::LONGEST);
+    return scratch.matches;
   }
 };
 
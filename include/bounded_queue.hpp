@@ -0,0 +1,130 @@
+#ifndef REGEX_BOUNDED_QUEUE
+#define REGEX_BOUNDED_QUEUE
+
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "utility.hpp"
+
+
+/* A fixed size queue for any number of producers and consumers.
+
+   Every cell carries a sequence number telling whether it is free for the
+   push of the current round or holds the value for the pop of the current
+   round, producers and consumers claim a cell by advancing their position
+   with a compare exchange and never take a lock. push() and pop() park
+   the thread on a futex while the queue is full or empty. */
+template<class T>
+class BoundedQueue {
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+
+  alignas(64) std::atomic<size_t> push_position;
+  alignas(64) std::atomic<size_t> pop_position;
+  // changed after every push and pop, waiting threads park on it
+  alignas(64) std::atomic<uint32_t> version;
+
+  void notify() {
+    version.fetch_add(1, std::memory_order_release);
+    version.notify_all();
+  }
+
+public:
+  // the capacity is rounded up to a power of two
+  explicit BoundedQueue(size_t capacity) :
+      cells{}, mask{0}, push_position{0}, pop_position{0}, version{0}
+  {
+    size_t size = 1;
+    while (size < capacity) { size <<= 1; }
+
+    cells = std::make_unique<Cell[]>(size);
+    mask = size - 1;
+
+    for (size_t i = 0; i < size; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool try_push(T &value) {
+    auto position = push_position.load(std::memory_order_relaxed);
+
+    while (true) {
+      auto &cell = cells[position & mask];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      auto diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+      if (diff == 0) {
+        if (push_position.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed
+        )) {
+          cell.value = std::move(value);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          notify();
+          return true;
+        }
+      } else if (diff < 0) {
+        // the cell still holds the value of the previous round, full
+        return false;
+      } else {
+        position = push_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T &value) {
+    auto position = pop_position.load(std::memory_order_relaxed);
+
+    while (true) {
+      auto &cell = cells[position & mask];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      auto diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+      if (diff == 0) {
+        if (pop_position.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed
+        )) {
+          value = std::move(cell.value);
+          cell.sequence.store(position + mask + 1, std::memory_order_release);
+          notify();
+          return true;
+        }
+      } else if (diff < 0) {
+        // the cell is not filled yet, empty
+        return false;
+      } else {
+        position = pop_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(T value) {
+    while (true) {
+      auto current = version.load(std::memory_order_acquire);
+      if (try_push(value)) { return; }
+      version.wait(current, std::memory_order_acquire);
+    }
+  }
+
+  T pop() {
+    T value{};
+
+    while (true) {
+      auto current = version.load(std::memory_order_acquire);
+      if (try_pop(value)) { return value; }
+      version.wait(current, std::memory_order_acquire);
+    }
+  }
+};
+
+
+#endif // REGEX_BOUNDED_QUEUE
@@ -1,3 +1,7 @@
+#ifndef REGEX_CHARACTER_SET
+#define REGEX_CHARACTER_SET
+
+
 #include <cstdint>
 #include <array>
 #include <iostream>
@@ -353,3 +357,6 @@ static constexpr std::array<uint8_t, 16> CHARACTER_SET_WORD{
   0b11111111, //  p   q   r   s   t   u   v   w
   0b00000111, //  x   y   z   {   |   }   ~   DEL
 };
+
+
+#endif // REGEX_CHARACTER_SET
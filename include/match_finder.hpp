@@ -0,0 +1,77 @@
+#ifndef REGEX_MATCH_FINDER
+#define REGEX_MATCH_FINDER
+
+
+#include <iterator>
+#include <optional>
+#include <string_view>
+
+#include "program.hpp"
+#include "simulation.hpp"
+
+
+/* Finds the matches of a regex in one input, the leftmost longest ones
+   not overlapping, the same matches a RegexStream reports.
+
+   Every search starts where the previous match ends, reusing the state of
+   the simulation, so finding a match allocates nothing once the state has
+   grown to the size the regex needs. The program and the input must
+   outlive the finder. */
+class MatchFinder {
+public:
+  using MatchRange = std::pair<size_t, size_t>;
+
+  class Iterator {
+  private:
+    MatchFinder *finder;
+    std::optional<MatchRange> match;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = MatchRange;
+    using difference_type = std::ptrdiff_t;
+
+    Iterator() : finder{nullptr}, match{} {}
+
+    explicit Iterator(MatchFinder &finder) :
+        finder{&finder}, match{finder.next()} {}
+
+    const MatchRange &operator*() const { return match.value(); }
+
+    const MatchRange *operator->() const { return &match.value(); }
+
+    Iterator &operator++() {
+      match = finder->next();
+      return *this;
+    }
+
+    void operator++(int) { ++*this; }
+
+    bool operator==(std::default_sentinel_t) const { return !match; }
+  };
+
+private:
+  static constexpr size_t NO_START = Simulation::NO_START;
+
+  Simulation simulation;
+  std::string_view input;
+  bool anchored;
+  // where the next search starts, NO_START once no match is left
+  size_t search_start;
+
+public:
+  MatchFinder(const Program &program, std::string_view input) :
+      simulation{program}, input{input}, anchored{program.is_anchored()},
+      search_start{0} {}
+
+  // the next match, nothing once all are found
+  std::optional<MatchRange> next();
+
+  // iterating consumes the matches
+  Iterator begin() { return Iterator{*this}; }
+
+  std::default_sentinel_t end() const { return std::default_sentinel; }
+};
+
+
+#endif // REGEX_MATCH_FINDER
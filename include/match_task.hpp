@@ -0,0 +1,122 @@
+#ifndef REGEX_MATCH_TASK
+#define REGEX_MATCH_TASK
+
+
+#include <coroutine>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "utility.hpp"
+#include "program.hpp"
+
+
+/* A coroutine matching input handed to it buffer by buffer, the matches
+   are those a RegexStream reports.
+
+   The producer pushes a buffer and calls next() until it returns nothing:
+   the coroutine runs until it confirms a match, which next() returns, or
+   until it needs more input, where it suspends. The buffer must stay valid
+   until then. After close() the remaining matches are reported and the
+   task is done. Only the coroutine frame holds the matching state, a task
+   per connection needs no thread and no buffer of the whole input. */
+class MatchTask {
+public:
+  using MatchRange = std::pair<size_t, size_t>;
+
+  // awaited by the coroutine for the next buffer, nothing once closed
+  struct NextInput {};
+
+  struct promise_type {
+    std::optional<std::string_view> input{};
+    bool closed{false};
+    // suspended until a buffer is pushed
+    bool waiting{false};
+    std::optional<MatchRange> event{};
+
+    MatchTask get_return_object() {
+      return MatchTask{
+          std::coroutine_handle<promise_type>::from_promise(*this)
+      };
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    std::suspend_always yield_value(MatchRange match) {
+      event = match;
+      return {};
+    }
+
+    void return_void() {}
+
+    void unhandled_exception() { std::terminate(); }
+
+    struct InputAwaiter {
+      promise_type &promise;
+
+      bool await_ready() const { return promise.input || promise.closed; }
+
+      void await_suspend(std::coroutine_handle<promise_type>) {
+        promise.waiting = true;
+      }
+
+      std::optional<std::string_view> await_resume() {
+        promise.waiting = false;
+        return std::exchange(promise.input, std::nullopt);
+      }
+    };
+
+    InputAwaiter await_transform(NextInput) { return InputAwaiter{*this}; }
+  };
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit MatchTask(std::coroutine_handle<promise_type> handle) :
+      handle{handle} {}
+
+public:
+  static MatchTask start(const Program &program);
+
+  MatchTask(const MatchTask &other) = delete;
+
+  MatchTask(MatchTask &&other) :
+      handle{std::exchange(other.handle, nullptr)} {}
+
+  MatchTask &operator=(const MatchTask &other) = delete;
+
+  MatchTask &operator=(MatchTask &&other) {
+    std::swap(handle, other.handle);
+    return *this;
+  }
+
+  ~MatchTask() {
+    if (handle) { handle.destroy(); }
+  }
+
+  // hand the next buffer, the previous one must be used up
+  void push(std::string_view chunk) {
+    regex_assert(!handle.promise().input && !handle.promise().closed);
+    handle.promise().input = chunk;
+  }
+
+  // no more input follows
+  void close() { handle.promise().closed = true; }
+
+  // the next confirmed match, nothing if more input is needed or the task
+  // is done
+  std::optional<MatchRange> next();
+
+  bool done() const { return handle.done(); }
+
+  // suspended until a buffer is pushed or the task is closed
+  bool wants_input() const {
+    auto &promise = handle.promise();
+    return !handle.done() && !promise.input && !promise.closed;
+  }
+};
+
+
+#endif // REGEX_MATCH_TASK
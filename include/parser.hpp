@@ -9,6 +9,15 @@
 #include "reg_graph.hpp"
 
 
+// the part of the top level concatenation of a regex a parser builds
+enum class ParsePart {
+  WHOLE,
+  // the elements before the split one, anchored at their end
+  BEFORE,
+  // the elements after the split one, anchored at their start
+  AFTER,
+};
+
 class Parser {
 public:
   using GraphStack = std::vector<std::pair<TokenType, std::vector<RegGraph>>>;
@@ -16,14 +25,40 @@ public:
 
   RegexTokenizer &tokenizer;
   RegGraph regex_graph;
+  MatchSemantics semantics;
+  // wrap every group in capture tags, groups are numbered from 1 by their
+  // left parenthesis
+  bool captures;
+  // build the graph of the reversed regex, matching the reversed strings
+  bool reverse;
+  uint32_t group_size;
+  // the groups of the parentheses still open
+  std::vector<uint32_t> group_stack;
+  // the longest string element of the top level concatenation, every
+  // match holds it, found by build_graph unless the regex has a top level
+  // alternation
+  std::optional<size_t> literal_index;
+  std::string literal;
+  ParsePart part;
+  // the element the top level concatenation is split at
+  size_t part_index;
   bool debug;
 
 
   std::optional<std::string> build_graph();
   RegGraph pop_and_join();
+  // the elements of the top layer one after another
+  RegGraph concatenate_top();
 
-  Parser(RegexTokenizer &tokenizer) :
-      tokenizer{tokenizer}, regex_graph{}, debug{false}
+  Parser(
+      RegexTokenizer &tokenizer,
+      MatchSemantics semantics = MatchSemantics::LONGEST,
+      bool captures = false, bool reverse = false
+  ) :
+      tokenizer{tokenizer}, regex_graph{}, semantics{semantics},
+      captures{captures}, reverse{reverse}, group_size{0}, group_stack{},
+      literal_index{}, literal{}, part{ParsePart::WHOLE}, part_index{0},
+      debug{false}
   {
     debug =
         std::getenv("REGEX_DEBUG") != nullptr ||
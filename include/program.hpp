@@ -0,0 +1,283 @@
+#ifndef REGEX_PROGRAM
+#define REGEX_PROGRAM
+
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <iostream>
+
+#include "utility.hpp"
+#include "character_set.hpp"
+#include "reg_graph.hpp"
+
+
+// the match an engine running a program reports
+enum class MatchPolicy {
+  // the match starting first, the longest one of them
+  LEFTMOST_LONGEST,
+  // the longest match anywhere, the one starting first of them, the match
+  // of MatchSemantics::LONGEST
+  LONGEST,
+  // any match, the first one found ends the search
+  ANY,
+  // the match starting first, the first path of them in the order of the
+  // edges, for programs compiled with MatchSemantics::LEFTMOST_FIRST
+  LEFTMOST_FIRST,
+};
+
+/* A program is the flat, position independent form of an optimized
+   RegGraph. Nodes and edges refer to each other by index, and all of them
+   live in one image which is laid out as
+
+     header | nodes | edges | character sets | dispatch offsets
+            | dispatch indices | strings | required characters
+            | split string | source
+
+   Every section is aligned to 8 bytes and the image size is a multiple of
+   8, so images can be stored back to back in one file and used in place
+   after mapping the file. */
+
+struct ProgramSection {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct ProgramHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian_mark;
+  uint64_t image_size;
+  uint32_t head;
+  uint32_t tail;
+  // number of patterns reported by MATCH_END nodes
+  uint32_t pattern_size;
+  uint32_t flags;
+  // length bounds of a match, max_length is RegGraph::UNBOUNDED_LENGTH if
+  // the regex has an unbounded loop
+  uint64_t min_length;
+  uint64_t max_length;
+  // index of the split string in the top level concatenation, or NO_SPLIT
+  uint64_t split_index;
+  ProgramSection node;
+  ProgramSection edge;
+  ProgramSection set;
+  ProgramSection dispatch_offset;
+  ProgramSection dispatch_index;
+  ProgramSection string;
+  // the characters every match consumes, found once at compile time
+  ProgramSection required_chars;
+  ProgramSection split_string;
+  ProgramSection source;
+};
+
+struct ProgramNode {
+  uint32_t marker;
+  uint32_t pattern;
+  uint32_t edge_begin;
+  uint32_t edge_end;
+  // index of the first dispatch offset of the node, or NO_DISPATCH
+  uint32_t dispatch;
+  uint32_t flags;
+};
+
+struct ProgramEdge {
+  uint32_t type;
+  uint32_t dest;
+  // CONCATENATION: string offset and size,
+  // CHARACTER_SET: set index,
+  // REPEAT/EXIT_LOOP: lower bound and upper bound
+  uint64_t value;
+  uint64_t size;
+};
+
+class Program {
+public:
+  static constexpr char MAGIC[8] = {'R', 'E', 'G', 'X', 'P', 'R', 'O', 'G'};
+  static constexpr uint32_t VERSION = 7;
+  static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+  static constexpr uint32_t NO_DISPATCH = UINT32_MAX;
+  static constexpr uint64_t NO_SPLIT = UINT64_MAX;
+  // any input can be consumed to its end from the node, a MATCH_END node
+  // with this flag accepts wherever it is reached
+  static constexpr uint32_t NODE_UNIVERSAL = 1;
+  // the edges of every node are ordered by priority, the match is the
+  // first accepting path
+  static constexpr uint32_t PROGRAM_LEFTMOST_FIRST = 1;
+
+private:
+  // keeps the memory of the image alive, either an owned buffer or a
+  // mapped file shared by many programs
+  std::shared_ptr<const void> storage;
+  const ProgramHeader *header;
+  const ProgramNode *nodes;
+  const ProgramEdge *edges;
+  const CharacterSet *sets;
+  const uint32_t *dispatch_offset;
+  const uint32_t *dispatch_index;
+  const char *strings;
+  // unique to every viewed image and never reused, copies of a program
+  // share it
+  uint64_t id;
+
+  Program() :
+      storage{}, header{nullptr}, nodes{nullptr}, edges{nullptr},
+      sets{nullptr}, dispatch_offset{nullptr}, dispatch_index{nullptr},
+      strings{nullptr}, id{0} {}
+
+  template<class T>
+  const T *section(const ProgramSection &section) const {
+    return reinterpret_cast<const T *>(
+        reinterpret_cast<const char *>(header) + section.offset
+    );
+  }
+
+  bool validate() const;
+
+  static void mark_universal(
+      std::vector<ProgramNode> &nodes, const std::vector<ProgramEdge> &edges,
+      const std::vector<CharacterSet> &sets
+  );
+
+  // one pass over the program per character consumed by an edge, kept in
+  // the image so that loading a program never repeats them
+  static std::string find_required_chars(
+      const std::vector<ProgramNode> &nodes,
+      const std::vector<ProgramEdge> &edges,
+      const std::vector<CharacterSet> &sets, std::string_view strings
+  );
+
+public:
+  // the graph must be optimized keeping the order of edges under
+  // LEFTMOST_FIRST
+  static Program compile(
+      RegGraph &graph, std::string_view source,
+      MatchSemantics semantics = MatchSemantics::LONGEST
+  );
+
+  // check and use the image in place, the image must stay alive as long
+  // as the storage is alive
+  static std::optional<Program> view(
+      std::shared_ptr<const void> storage, const void *image, size_t size
+  );
+
+  std::string_view image() const {
+    return std::string_view{
+        reinterpret_cast<const char *>(header), header->image_size
+    };
+  }
+
+  std::string_view source() const {
+    return std::string_view{
+        section<char>(header->source), header->source.size
+    };
+  }
+
+  // engines bound to a program of the same id keep what they derived
+  // from it
+  uint64_t image_id() const { return id; }
+
+  uint32_t head() const { return header->head; }
+
+  uint32_t tail() const { return header->tail; }
+
+  size_t pattern_size() const { return header->pattern_size; }
+
+  MatchSemantics semantics() const {
+    return (header->flags & PROGRAM_LEFTMOST_FIRST) != 0 ?
+        MatchSemantics::LEFTMOST_FIRST : MatchSemantics::LONGEST;
+  }
+
+  size_t node_size() const { return header->node.size; }
+
+  size_t edge_size() const { return header->edge.size; }
+
+  const ProgramNode &node(uint32_t index) const { return nodes[index]; }
+
+  NodeMarker marker(uint32_t index) const {
+    return static_cast<NodeMarker>(nodes[index].marker);
+  }
+
+  bool is_universal(uint32_t index) const {
+    return (nodes[index].flags & NODE_UNIVERSAL) != 0;
+  }
+
+  // the regex can only match at the start of input
+  bool is_anchored() const {
+    return marker(head()) == NodeMarker::MATCH_BEGIN;
+  }
+
+  // the regex can only match at the end of input
+  bool is_end_anchored() const {
+    return marker(tail()) == NodeMarker::MATCH_END;
+  }
+
+  size_t min_length() const { return header->min_length; }
+
+  size_t max_length() const { return header->max_length; }
+
+  // the characters every match consumes, an input missing one of them has
+  // no match, loop counters are not checked so some may be left out
+  std::string_view required_chars() const {
+    return std::string_view{
+        section<char>(header->required_chars), header->required_chars.size
+    };
+  }
+
+  // the index of the longest string element of the top level
+  // concatenation, nothing if it has none or the regex has a top level
+  // alternation
+  std::optional<size_t> split_index() const {
+    if (header->split_index == NO_SPLIT) { return std::nullopt; }
+    return header->split_index;
+  }
+
+  // the string at split_index, the view points into the image
+  std::string_view split_string() const {
+    return std::string_view{
+        section<char>(header->split_string), header->split_string.size
+    };
+  }
+
+  // the string every match is, if the regex is one string and anchors,
+  // the view points into the image
+  std::optional<std::string_view> literal() const;
+
+  const ProgramEdge &edge(uint32_t index) const { return edges[index]; }
+
+  static EdgeType edge_type(const ProgramEdge &edge) {
+    return static_cast<EdgeType>(edge.type);
+  }
+
+  std::string_view string(const ProgramEdge &edge) const {
+    return std::string_view{strings + edge.value, edge.size};
+  }
+
+  const CharacterSet &set(const ProgramEdge &edge) const {
+    return sets[edge.value];
+  }
+
+  static RepeatRange range(const ProgramEdge &edge) {
+    return RepeatRange{edge.value, edge.size};
+  }
+
+  // indices of the edges of the node which may be taken on the slot,
+  // relative to the first edge of the node
+  std::pair<const uint32_t *, const uint32_t *>
+  dispatch(const ProgramNode &node, size_t slot) const {
+    return std::make_pair(
+        dispatch_index + dispatch_offset[node.dispatch + slot],
+        dispatch_index + dispatch_offset[node.dispatch + slot + 1]
+    );
+  }
+
+  void print_edge(std::ostream &stream, const ProgramEdge &edge) const;
+
+  friend std::ostream &operator<<(std::ostream &stream, const Program &other);
+};
+
+
+#endif // REGEX_PROGRAM
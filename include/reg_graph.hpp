@@ -6,6 +6,8 @@
 #include <new>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <optional>
 #include <iostream>
 #include <unordered_map>
 #include <unordered_set>
@@ -27,13 +29,26 @@ enum class NodeMarker {
   MATCH_END,
 };
 
+// which of the paths accepting from the leftmost start is the match
+enum class MatchSemantics {
+  // the longest one, as POSIX
+  LONGEST,
+  // the first one in the order of the edges, as Perl: alternatives are
+  // tried from the left and quantifiers are greedy
+  LEFTMOST_FIRST,
+};
+
 class RegGraph {
 public:
   using NodePtr = List<Node>::Iter;
 
+  // the max length of a graph with an unbounded loop
+  static constexpr size_t UNBOUNDED_LENGTH = SIZE_MAX;
+
 private:
   static constexpr size_t LOOP_UNROLL_SIZE_LIMIT = 1024;
   static constexpr size_t LOOP_UNROLL_MUL_LIMIT = 32;
+  static constexpr size_t DISPATCH_EDGE_LIMIT = 4;
 
   NodePtr create_node() {
     size += 1;
@@ -75,15 +90,46 @@ private:
 
   bool replace_empty_transition(NodeSet &new_nodes);
 
+  // the edges of the node with every empty edge to an anonymous node
+  // replaced in place by the edges of that node
+  std::vector<std::pair<Edge, NodePtr>> expand_empty_edge(NodePtr node);
+
   bool fold_empty_edge(NodeSet &new_nodes);
 
+  using BlockMap = std::unordered_map<NodePtr, size_t>;
+
+  BlockMap bisimulation_partition(bool backward);
+
+  bool merge_bisimilar_node(NodeSet &new_nodes, bool backward);
+
+  bool merge_forward_bisimilar_node(NodeSet &new_nodes);
+
+  bool merge_backward_bisimilar_node(NodeSet &new_nodes);
+
+  void build_dispatch_table();
+
 public:
   List<Node> nodes;
   NodePtr head;
   NodePtr tail;
   size_t size;
-
-  RegGraph() : nodes{}, head{}, tail{}, size{} {
+  // the order of the edges of a node is their priority and is kept by
+  // every pass, needed by LEFTMOST_FIRST and by capture tags
+  bool ordered;
+  // length bounds of the strings from head to tail, kept by every operation
+  // building the graph, the parts before MATCH_BEGIN and after MATCH_END
+  // are not counted
+  size_t min_length;
+  size_t max_length;
+  // the longest string element of the top level concatenation and its
+  // index, set by the parser of a whole regex, every match holds it
+  std::optional<size_t> split_index;
+  std::string split_string;
+
+  RegGraph() :
+      nodes{}, head{}, tail{}, size{}, ordered{false}, min_length{0},
+      max_length{0}, split_index{}, split_string{}
+  {
     head = create_node();
     tail = create_node();
   }
@@ -92,6 +138,10 @@ public:
 
   static RegGraph join_graph(RegGraph &&graph1, RegGraph &&graph2);
 
+  // join graphs under one head, unlike join_graph the tails of the graphs
+  // are not connected to the new tail
+  static RegGraph union_graph(std::vector<RegGraph> &&graphs);
+
   template<class GraphPtr>
   static RegGraph concatenate_graph(GraphPtr begin, GraphPtr end);
 
@@ -108,7 +158,17 @@ public:
 
   void match_tail_unknown();
 
-  void optimize_graph();
+  // wrap the graph in the tags recording the offsets of a capture group
+  void capture_group(uint32_t group);
+
+  // the string matched by a graph of one CONCATENATION edge
+  std::optional<std::string_view> literal_string();
+
+  void set_pattern(uint32_t pattern);
+
+  size_t edge_size();
+
+  void optimize_graph(bool debug = false, bool ordered = false);
 
   friend std::ostream &operator<<(std::ostream &stream, RegGraph &other);
 
@@ -123,16 +183,50 @@ public:
 
 class Node {
 public:
+  // slot 0 - 127 for ascii input, the last slot for end of input and none
+  // ascii input
+  static constexpr size_t DISPATCH_SLOT_SIZE = 129;
+
   NodeMarker marker;
+  // pattern reported by a MATCH_END node when graphs of many regexes are
+  // joined together
+  uint32_t pattern;
   std::vector<std::pair<Edge, RegGraph::NodePtr>> edges;
+  // indices of the edges that may be taken on each dispatch slot, stored
+  // slot by slot, empty if the node does not have a dispatch table
+  std::vector<uint32_t> dispatch_offset;
+  std::vector<uint32_t> dispatch_index;
 
-  Node() : marker{NodeMarker::ANONYMOUS}, edges{} {}
+  Node() :
+      marker{NodeMarker::ANONYMOUS}, pattern{0}, edges{}, dispatch_offset{},
+      dispatch_index{} {}
 
   void add_edge(Edge &&edge, RegGraph::NodePtr next);
 
   void add_empty_edge(RegGraph::NodePtr next);
 
   void unique_edge();
+
+  // drop repeated edges and keep the first one of each, the order of the
+  // edges is kept
+  void unique_edge_in_order();
+
+  void build_dispatch();
+
+  bool has_dispatch() const { return !dispatch_offset.empty(); }
+
+  static size_t dispatch_slot(char c) {
+    auto value = static_cast<unsigned char>(c);
+    return value < DISPATCH_SLOT_SIZE - 1 ? value : DISPATCH_SLOT_SIZE - 1;
+  }
+
+  std::pair<const uint32_t *, const uint32_t *>
+  dispatch(size_t slot) const {
+    return std::make_pair(
+        dispatch_index.data() + dispatch_offset[slot],
+        dispatch_index.data() + dispatch_offset[slot + 1]
+    );
+  }
 };
 
 enum class EdgeType {
@@ -142,6 +236,8 @@ enum class EdgeType {
   REPEAT,
   ENTER_LOOP,
   EXIT_LOOP,
+  // consumes nothing, records the offset in a capture tag
+  TAG,
 };
 
 class Edge {
@@ -152,6 +248,8 @@ private:
 
   Edge(EdgeType type, RepeatRange range) : type{type}, range{range} {}
 
+  Edge(EdgeType type, uint32_t tag) : type{type}, tag{tag} {}
+
   Edge(EdgeType type) : type{type}, null{} {}
 
   void drop() {
@@ -178,6 +276,9 @@ private:
       case EdgeType::CHARACTER_SET:
         set = other.set;
         break;
+      case EdgeType::TAG:
+        tag = other.tag;
+        break;
       default:
         break;
     }
@@ -197,6 +298,9 @@ private:
       case EdgeType::CHARACTER_SET:
         set = other.set;
         break;
+      case EdgeType::TAG:
+        tag = other.tag;
+        break;
       default:
         break;
     }
@@ -209,6 +313,7 @@ public:
     std::string string;
     RepeatRange range;
     CharacterSet set;
+    uint32_t tag;
   };
 
   Edge() : type{EdgeType::EMPTY}, null{} {}
@@ -225,6 +330,8 @@ public:
     return Edge{EdgeType::REPEAT, range};
   }
 
+  static Edge capture_tag(uint32_t tag) { return Edge{EdgeType::TAG, tag}; }
+
   static Edge concanetation(std::string value) {
     regex_assert(value.size() > 0);
     return Edge{value};
@@ -339,6 +446,8 @@ public:
           return range == other.range;
         case EdgeType::CHARACTER_SET:
           return set == other.set;
+        case EdgeType::TAG:
+          return tag == other.tag;
         default:
           regex_abort("invalid type");
       }
@@ -360,6 +469,8 @@ public:
           return range < other.range;
         case EdgeType::CHARACTER_SET:
           return set < other.set;
+        case EdgeType::TAG:
+          return tag < other.tag;
         default:
           regex_abort("invalid type");
       }
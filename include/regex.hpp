@@ -2,23 +2,275 @@
 #define REGEX_REGEX
 
 
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <ostream>
+#include <span>
 #include <string_view>
 #include <string>
+#include <vector>
 
-#include "reg_graph.hpp"
+#include "program.hpp"
+#include "automata.hpp"
+#include "regex_stream.hpp"
+#include "match_task.hpp"
+#include "match_finder.hpp"
 
 
+// the engines a regex may be matched by, the cheapest first
+enum class MatchEngine {
+  // the regex is one string, searched with memmem
+  LITERAL,
+  // the reversed program stepped from the end of input, for regexes
+  // anchored only at the end
+  REVERSE,
+  // the longest match grown both ways from the occurrences of an inner
+  // string, under LONGEST only
+  SPLIT,
+  // the backtracking Automata, it keeps no record of the paths it tried
+  // and may take time exponential in the input, never chosen by Regex::plan
+  BACKTRACK,
+  // the Simulation stepping all paths at once, linear in the input
+  SIMULATION,
+};
+
+// how a regex is matched, chosen from its program by Regex::plan, or set
+// by Regex::with_plan to compare engines
+struct MatchPlan {
+  // inputs too short or too long for a match are rejected, and only the
+  // part of the input a match lies in is read
+  bool window{true};
+  // inputs missing a required character are rejected
+  bool required_chars{true};
+  MatchEngine engine{MatchEngine::SIMULATION};
+  // the longest input the BACKTRACK engine matches, longer inputs are
+  // stepped by the Simulation
+  size_t backtrack_limit{0};
+
+  friend std::ostream &operator<<(std::ostream &stream, const MatchPlan &other);
+};
+
 class Regex {
+public:
+  // the range of every group, group 0 is the whole match, a group its path
+  // did not take has none
+  using Captures = std::vector<std::optional<std::pair<size_t, size_t>>>;
+
 private:
-  RegGraph graph;
+  // smallest part of the input matched by one thread in parallel
+  static constexpr size_t PARALLEL_CHUNK_SIZE = 1 << 16;
+  // the split search gives up within the scan reading more than this many
+  // times the input, the Simulation then matches it in one more pass
+  static constexpr size_t SPLIT_SCAN_FACTOR = 1;
+
+  // a program compiled again from the source the first time it is needed,
+  // shared by the copies of the regex
+  struct LazyProgram {
+    std::once_flag once{};
+    std::optional<Program> program{};
+    size_t group_size{0};
+  };
+
+  // the regex split at the split string of its program, the reversed part
+  // before the string and the part after it, both anchored at the string,
+  // compiled the first time the SPLIT engine runs
+  struct SplitProgram {
+    std::once_flag once{};
+    std::optional<Program> before{};
+    std::optional<Program> after{};
+  };
+
+  struct LazyPlan {
+    std::once_flag once{};
+    MatchPlan plan{};
+  };
+
+  Program program;
+  // the program with capture tags
+  std::shared_ptr<LazyProgram> capture_program;
+  // the program of the reversed regex, for regexes anchored only at the end
+  std::shared_ptr<LazyProgram> reverse_program;
+  std::shared_ptr<SplitProgram> split_program;
+  std::shared_ptr<LazyPlan> match_plan;
+  // the characters every match consumes, the view points into the image
+  std::string_view required_chars;
+  // the string every match is, searched for without any automata
+  std::optional<std::string_view> literal;
+
+  Regex(Program &&program) :
+      program{std::move(program)},
+      capture_program{std::make_shared<LazyProgram>()},
+      reverse_program{std::make_shared<LazyProgram>()},
+      split_program{std::make_shared<SplitProgram>()},
+      match_plan{std::make_shared<LazyPlan>()},
+      required_chars{this->program.required_chars()},
+      literal{this->program.literal()} {}
+
+  const LazyProgram &compile_lazy(
+      LazyProgram &lazy, MatchSemantics semantics, bool captures, bool reverse
+  ) const;
+
+  const LazyProgram &compile_captures() const {
+    return compile_lazy(*capture_program, semantics(), true, false);
+  }
+
+  // the reversed regex is only matched anchored from the end of input, all
+  // its matches are found under LONGEST
+  const LazyProgram &compile_reverse() const {
+    return compile_lazy(*reverse_program, MatchSemantics::LONGEST, false, true);
+  }
+
+  // the match of a regex anchored only at the end, found by stepping the
+  // reversed program from the end of input
+  std::optional<std::pair<size_t, size_t>>
+  match_reverse(std::string_view input) const;
+
+  const SplitProgram &compile_split() const;
+
+  // the longest match found from every occurrence of the split string, the
+  // part before it stepped backward and the part after it forward, under
+  // any the match of the first occurrence with one
+  std::optional<std::pair<size_t, size_t>> match_split(
+      std::string_view input, Simulation &simulation, bool any = false
+  ) const;
+
+  // the first occurrence of the literal at or after the offset, found by
+  // the Two-Way search of memmem, linear in the input
+  size_t find_literal(std::string_view input, size_t offset) const;
+
+  // the match of a regex which is one string, at the anchors if any
+  std::optional<std::pair<size_t, size_t>>
+  match_literal(std::string_view input) const;
+
+  // the match found by one Simulation pass over the input
+  std::optional<std::pair<size_t, size_t>>
+  match_simulation(std::string_view input, Simulation &simulation) const;
+
+  // narrow the input to the part every match lies in, returns the offset
+  // of the part, nothing if the input is too short or too long for a match
+  std::optional<size_t> match_window(std::string_view &input) const;
+
+  // pick the cheapest engine able to match the regex, the Simulation when
+  // no cheaper one applies
+  MatchPlan make_plan() const;
 
-  Regex(RegGraph &&graph) : graph{std::move(graph)} {}
+  // whether the filters of the plan prove the input has no match
+  bool is_rejected(std::string_view input) const {
+    auto &plan = this->plan();
+
+    return
+        (plan.window && input.size() < program.min_length()) ||
+        (plan.required_chars && !has_required_chars(input));
+  }
+
+  // whether the input holds every required character, each one is searched
+  // with memchr, which scans many bytes per instruction
+  bool has_required_chars(std::string_view input) const {
+    for (char c : required_chars) {
+      if (input.find(c) == std::string_view::npos) { return false; }
+    }
+    return true;
+  }
 
 public:
-  static std::optional<Regex> init(std::string_view regex);
+  // under LEFTMOST_FIRST every search returns the match a backtracking
+  // engine such as Perl finds, instead of the longest one
+  static std::optional<Regex> init(
+      std::string_view regex,
+      MatchSemantics semantics = MatchSemantics::LONGEST
+  );
+
+  // map a file written by save() and match directly on the mapped pages,
+  // the file may hold any number of regexes
+  static std::optional<std::vector<Regex>> load(const std::string &path);
+
+  // append the binary image of the regex to the stream
+  bool save(std::ostream &stream) const;
+
+  std::string_view source() const { return program.source(); }
+
+  MatchSemantics semantics() const { return program.semantics(); }
+
+  // no match is shorter, inputs shorter than it are rejected at once
+  size_t min_length() const { return program.min_length(); }
+
+  // no match is longer, nothing if a match may be as long as any input
+  std::optional<size_t> max_length() const {
+    if (program.max_length() == RegGraph::UNBOUNDED_LENGTH) {
+      return std::nullopt;
+    }
+    return program.max_length();
+  }
+
+  // the plan every match follows, made the first time it is needed
+  const MatchPlan &plan() const;
+
+  // whether the engine can match the regex, BACKTRACK and SIMULATION match
+  // every regex
+  bool supports(MatchEngine engine) const;
+
+  // a copy of the regex matched by another plan, to compare engines,
+  // nothing if its engine cannot match the regex
+  std::optional<Regex> with_plan(const MatchPlan &plan) const;
+
+  // a compiled regex is immutable, matching is safe from many threads, the
+  // first overload uses a scratch owned by the calling thread
+  std::optional<std::pair<size_t, size_t>>
+  match(std::string_view input) const;
+
+  std::optional<std::pair<size_t, size_t>>
+  match(std::string_view input, MatchScratch &scratch) const;
+
+  // whether the input has any match, the scan ends where the first match
+  // attempt accepts, or at the first occurrence of the split string with a
+  // match around it
+  bool is_match(std::string_view input) const;
+
+  // the match of match() and the offsets of its groups in one pass over
+  // the input. Under LEFTMOST_FIRST the groups are those of a backtracking
+  // engine, under LONGEST those of the first path in the order of the
+  // edges reaching the longest match. A group inside a loop holds its last
+  // iteration
+  std::optional<Captures> captures(std::string_view input) const;
+
+  // the number of groups, group 0 included
+  size_t capture_size() const { return compile_captures().group_size + 1; }
+
+  // match input split into segments as if they were joined, a match may
+  // span any number of segments, the offsets count from the first segment
+  std::optional<std::pair<size_t, size_t>>
+  match(std::span<const std::string_view> segments) const;
+
+  // the leftmost matches not overlapping, the longest or the first one of
+  // every start by the semantics, the regex and the input must outlive the
+  // finder. The Simulation finds them whatever the plan
+  MatchFinder find_all(std::string_view input) const {
+    return MatchFinder{program, input};
+  }
+
+  // replace the content of matches by all matches of the input, returns
+  // their number, nothing is allocated if matches holds enough capacity.
+  // Only a LITERAL plan is followed, the REVERSE and SPLIT engines find the
+  // one best match and not all leftmost ones, the Simulation finds those
+  size_t find_all(
+      std::string_view input, std::vector<std::pair<size_t, size_t>> &matches
+  ) const;
+
+  // the number of matches find_all finds, no match range is stored, the
+  // plan is followed as by find_all
+  size_t count(std::string_view input) const;
+
+  // match one large input on many threads, the same match is found, a plan
+  // of another engine than the Simulation is followed on one thread
+  std::optional<std::pair<size_t, size_t>>
+  match_parallel(std::string_view input, size_t thread_size) const;
+
+  // match input arriving in chunks, the regex must outlive the stream
+  RegexStream stream() const { return RegexStream{program}; }
 
-  std::optional<std::pair<size_t, size_t>> match(std::string_view input);
+  // a coroutine matching buffers as they arrive, the regex must outlive it
+  MatchTask match_task() const { return MatchTask::start(program); }
 };
 
 
@@ -0,0 +1,104 @@
+#ifndef REGEX_REGEX_CACHE
+#define REGEX_REGEX_CACHE
+
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "regex.hpp"
+
+
+// thread-safe cache of compiled regexes, split into shards which are each
+// guarded by their own lock and evict the least recently used entry
+class RegexCache {
+public:
+  using RegexPtr = std::shared_ptr<const Regex>;
+
+  static constexpr size_t SHARD_SIZE = 16;
+  static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+  struct Statistics {
+    size_t hit;
+    size_t miss;
+    size_t eviction;
+    size_t size;
+  };
+
+private:
+  // a regex compiled under another semantics is another entry
+  struct Key {
+    std::string_view regex;
+    MatchSemantics semantics;
+
+    bool operator==(const Key &other) const = default;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return
+          std::hash<std::string_view>{}(key.regex) ^
+          static_cast<size_t>(key.semantics);
+    }
+  };
+
+  struct Entry {
+    std::string regex;
+    MatchSemantics semantics;
+    RegexPtr compiled;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    // most recently used entry first
+    std::list<Entry> entries;
+    // keys are views into the strings owned by the entries
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+  };
+
+  std::array<Shard, SHARD_SIZE> shards;
+  std::atomic<size_t> shard_capacity;
+  std::atomic<size_t> hit;
+  std::atomic<size_t> miss;
+  std::atomic<size_t> eviction;
+
+  Shard &get_shard(const Key &key) {
+    return shards[KeyHash{}(key) % SHARD_SIZE];
+  }
+
+  void shrink(Shard &shard, size_t capacity);
+
+public:
+  explicit RegexCache(size_t capacity = DEFAULT_CAPACITY) :
+      shards{}, shard_capacity{1}, hit{0}, miss{0}, eviction{0}
+  {
+    set_capacity(capacity);
+  }
+
+  static RegexCache &global();
+
+  // returns the compiled regex, or nullptr if the regex is invalid
+  RegexPtr get(
+      std::string_view regex,
+      MatchSemantics semantics = MatchSemantics::LONGEST
+  );
+
+  // the capacity is the total number of entries, spread evenly on shards
+  void set_capacity(size_t capacity);
+
+  void clear();
+
+  Statistics statistics();
+
+  RegexCache(const RegexCache &other) = delete;
+
+  RegexCache &operator=(const RegexCache &other) = delete;
+};
+
+
+#endif // REGEX_REGEX_CACHE
@@ -0,0 +1,156 @@
+#ifndef REGEX_REGEX_HANDLE
+#define REGEX_REGEX_HANDLE
+
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utility.hpp"
+
+
+// hazard pointers of all threads, a reader publishes the pointer it is
+// going to use in one of the slots of its thread, and writers only delete
+// retired objects which are in no slot
+class HazardDomain {
+public:
+  static constexpr size_t SLOT_SIZE = 8;
+
+  struct Record {
+    std::atomic<const void *> slots[SLOT_SIZE];
+    std::atomic<bool> active;
+    Record *next;
+    // slots in use, only touched by the owner thread
+    uint32_t used;
+  };
+
+private:
+  std::atomic<Record *> records;
+
+  HazardDomain() : records{nullptr} {}
+
+  Record *acquire();
+
+public:
+  static HazardDomain &global();
+
+  // the record of the calling thread, released when the thread exits
+  Record &local();
+
+  void release(Record &record);
+
+  bool is_protected(const void *ptr);
+};
+
+// RCU-style handle to an immutable object, readers never lock: they get a
+// guard keeping the current version alive, writers publish a new version
+// and delete the old one once no guard holds it
+template<class T>
+class RegexHandle {
+private:
+  std::atomic<const T *> current;
+  std::mutex mutex;
+  std::vector<const T *> retired;
+
+  void reclaim_locked() {
+    auto &domain = HazardDomain::global();
+    std::vector<const T *> still_retired{};
+
+    for (auto ptr : retired) {
+      if (domain.is_protected(ptr)) {
+        still_retired.emplace_back(ptr);
+      } else {
+        delete ptr;
+      }
+    }
+
+    retired = std::move(still_retired);
+  }
+
+public:
+  class Guard {
+  private:
+    friend class RegexHandle;
+
+    HazardDomain::Record *record;
+    size_t slot;
+    const T *ptr;
+
+    Guard(const std::atomic<const T *> &current) :
+        record{&HazardDomain::global().local()}, slot{0}, ptr{nullptr}
+    {
+      while (slot < HazardDomain::SLOT_SIZE && (record->used >> slot & 1)) {
+        ++slot;
+      }
+      if (slot == HazardDomain::SLOT_SIZE) {
+        regex_abort("too many guards held by one thread");
+      }
+      record->used |= 1u << slot;
+
+      auto &hazard = record->slots[slot];
+      ptr = current.load(std::memory_order_acquire);
+
+      while (true) {
+        hazard.store(ptr, std::memory_order_seq_cst);
+        auto again = current.load(std::memory_order_seq_cst);
+        if (again == ptr) { break; }
+        ptr = again;
+      }
+    }
+
+  public:
+    const T *get() const { return ptr; }
+
+    const T &operator*() const { return *ptr; }
+
+    const T *operator->() const { return ptr; }
+
+    explicit operator bool() const { return ptr != nullptr; }
+
+    Guard(const Guard &other) = delete;
+
+    Guard &operator=(const Guard &other) = delete;
+
+    ~Guard() {
+      record->slots[slot].store(nullptr, std::memory_order_release);
+      record->used &= ~(1u << slot);
+    }
+  };
+
+  RegexHandle() : current{nullptr}, mutex{}, retired{} {}
+
+  explicit RegexHandle(std::unique_ptr<const T> value) : RegexHandle{} {
+    current.store(value.release(), std::memory_order_release);
+  }
+
+  // the guard must not outlive the thread nor be passed to other threads
+  Guard read() const { return Guard{current}; }
+
+  void publish(std::unique_ptr<const T> value) {
+    auto old = current.exchange(value.release(), std::memory_order_seq_cst);
+
+    std::lock_guard guard{mutex};
+    if (old != nullptr) { retired.emplace_back(old); }
+    reclaim_locked();
+  }
+
+  // delete the retired versions no reader holds anymore
+  void reclaim() {
+    std::lock_guard guard{mutex};
+    reclaim_locked();
+  }
+
+  RegexHandle(const RegexHandle &other) = delete;
+
+  RegexHandle &operator=(const RegexHandle &other) = delete;
+
+  // there must be no reader left
+  ~RegexHandle() {
+    delete current.load(std::memory_order_acquire);
+    for (auto ptr : retired) { delete ptr; }
+  }
+};
+
+
+#endif // REGEX_REGEX_HANDLE
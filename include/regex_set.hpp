@@ -0,0 +1,89 @@
+#ifndef REGEX_REGEX_SET
+#define REGEX_REGEX_SET
+
+
+#include <optional>
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include "program.hpp"
+#include "automata.hpp"
+
+
+/* Many regexes joined into one program, the MATCH_END node of every regex
+   is tagged with its pattern index, one run reports all the matching
+   regexes. The run is a Simulation of the joined program, its time is
+   linear in the input however many regexes the set holds.
+
+   Regexes can be added and removed without compiling the whole set again:
+   added regexes are compiled into a small delta program matched next to
+   the main program, removed regexes are only marked. Once there are too
+   many delta programs or removed regexes, the live regexes are compiled
+   into a new main program. Adding and removing must not run concurrently
+   with matching. */
+class RegexSet {
+private:
+  static constexpr size_t DELTA_LIMIT = 8;
+
+  struct Part {
+    Program program;
+    // regex index of every pattern of the program
+    std::vector<size_t> regex_index;
+  };
+
+  // the first part is the main program, the others are delta programs
+  std::vector<Part> parts;
+  std::vector<std::string> sources;
+  std::vector<bool> removed;
+  // removed regexes still present in the programs
+  size_t removed_size;
+
+  RegexSet() : parts{}, sources{}, removed{}, removed_size{0} {}
+
+  static std::optional<Part> compile(
+      const std::vector<std::string_view> &regexes,
+      std::vector<size_t> &&regex_index
+  );
+
+  void compact();
+
+  template<class Fn>
+  void run(std::string_view input, MatchScratch &scratch, Fn fn) const;
+
+public:
+  static std::optional<RegexSet>
+  init(const std::vector<std::string_view> &regexes);
+
+  // returns the index of the added regex, nullopt if it is invalid
+  std::optional<size_t> add(std::string_view regex);
+
+  // either all regexes are added or none
+  std::optional<std::vector<size_t>>
+  add(const std::vector<std::string_view> &regexes);
+
+  bool remove(size_t index);
+
+  // regexes are indexed by the order they are added, indices of removed
+  // regexes are never reused and never match
+  size_t size() const { return sources.size(); }
+
+  bool contains(size_t index) const {
+    return index < removed.size() && !removed[index];
+  }
+
+  // bit i is set if regex i matches the input
+  std::vector<bool> matches(std::string_view input) const;
+
+  std::vector<bool>
+  matches(std::string_view input, MatchScratch &scratch) const;
+
+  // the best match of every regex, same as matching them one by one
+  std::vector<MatchResult> match(std::string_view input) const;
+
+  std::vector<MatchResult>
+  match(std::string_view input, MatchScratch &scratch) const;
+};
+
+
+#endif // REGEX_REGEX_SET
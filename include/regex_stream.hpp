@@ -0,0 +1,63 @@
+#ifndef REGEX_REGEX_STREAM
+#define REGEX_REGEX_STREAM
+
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "program.hpp"
+#include "simulation.hpp"
+
+
+/* Finds the matches of a regex in input arriving in chunks, a match may
+   span any number of chunks.
+
+   Matches are the leftmost longest ones, not overlapping, reported with
+   offsets from the start of the stream as soon as no later input can
+   change them. Once a match is found the input after its end is searched
+   again, so only the input from the end of the best match so far is kept,
+   no more than the longest match when its length is bounded. Input behind
+   an unfinished match attempt is never kept. The program must outlive the
+   stream. */
+class RegexStream {
+private:
+  using MatchRange = std::pair<size_t, size_t>;
+
+  static constexpr size_t NO_START = Simulation::NO_START;
+
+  Simulation simulation;
+  bool anchored;
+
+  // the kept input, window[0] is at window_offset in the stream
+  std::string window;
+  size_t window_offset;
+  // offset of the next character to step
+  size_t offset;
+  // where the next search starts, NO_START when no match is possible
+  size_t search_start;
+  bool searching;
+
+  // matches found by the last call
+  std::vector<MatchRange> matches;
+
+  void run(bool end);
+
+public:
+  explicit RegexStream(const Program &program);
+
+  // the returned matches are valid until the next call
+  const std::vector<MatchRange> &feed(std::string_view chunk);
+
+  // the stream ends, report the remaining matches
+  const std::vector<MatchRange> &finish();
+
+  // start a new stream
+  void reset();
+
+  // size of the input kept for pending match attempts
+  size_t buffered() const { return window.size(); }
+};
+
+
+#endif // REGEX_REGEX_STREAM
@@ -0,0 +1,322 @@
+#ifndef REGEX_SIMULATION
+#define REGEX_SIMULATION
+
+
+#include <array>
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "utility.hpp"
+#include "program.hpp"
+
+
+/* Steps all paths of a program at once, one input character at a time.
+
+   Every path waiting on a consuming edge is a thread, threads at the same
+   edge with the same loop counters are merged and keep the leftmost start,
+   so the state only depends on the program and never on the input already
+   consumed. A search can therefore be suspended between any two characters
+   and resumed later, which the backtracking Automata cannot do.
+
+   A search finds the match chosen by the policy starting at or after the
+   offset it is started at. Threads are kept in the order their paths are
+   tried, so under LEFTMOST_FIRST an accepting path drops all threads
+   after it, as a backtracking search would never try them. Unbounded loop
+   counters saturate at their lower bound, larger counts behave the same.
+
+   A node with a dispatch table holds one thread for all its consuming
+   edges, a step only tries the edges of the slot of the character.
+   Threads of one node are not ordered by their edges, so programs whose
+   order of edges is the priority of the paths keep a thread per edge.
+
+   A program with capture tags gives every thread the offsets its path
+   recorded. Threads share the arrays of offsets, a TAG edge copies the
+   array of its path once and no array is copied by a step.
+
+   A program joining many regexes is searched under LONGEST, the best
+   match of every pattern is kept by the MATCH_END nodes of the pattern. */
+class Simulation {
+public:
+  static constexpr size_t NO_START = SIZE_MAX;
+
+private:
+  static constexpr uint32_t NO_LOOP = UINT32_MAX;
+  static constexpr uint32_t NO_EDGE = UINT32_MAX;
+  // no tag recorded yet, every tag is NO_START
+  static constexpr uint32_t NO_CAPTURES = UINT32_MAX;
+  // progress of a thread at a node with a dispatch table, its edge is the
+  // index of the node
+  static constexpr uint32_t AT_NODE = UINT32_MAX;
+  // collected arrays of offsets never shrink below this
+  static constexpr size_t MIN_CAPTURE_LIMIT = 64;
+
+  struct Thread {
+    uint32_t edge;
+    // characters of a CONCATENATION edge already consumed
+    uint32_t progress;
+    uint32_t loop;
+    // the array of offsets recorded by the path
+    uint32_t captures;
+    // NO_START while the thread is still before MATCH_BEGIN
+    size_t start;
+  };
+
+  struct LoopFrame {
+    uint32_t parent;
+    uint32_t count;
+  };
+
+  // a node to expand, or the edge of a thread to add once the paths tried
+  // before it are expanded
+  struct ClosureElem {
+    uint32_t node;
+    uint32_t loop;
+    uint32_t captures;
+    size_t start;
+    uint32_t edge{NO_EDGE};
+  };
+
+  const Program *program;
+  // the image the slots and start bytes were built for, 0 if none
+  uint64_t image_id;
+  MatchPolicy policy;
+  // the consuming edges of a node with a dispatch table share one thread
+  bool node_threads;
+  // first thread slot of every edge, a CONCATENATION edge takes one slot
+  // per character
+  std::vector<uint32_t> edge_slot;
+  // whether a match attempt may start at a byte, every byte if a match
+  // may be empty or the regex is anchored. Bytes out of ascii are kept
+  // too, a string of a regex holding such bytes may begin with one
+  std::array<bool, 256> start_byte;
+
+  // threads ordered by start, threads without start come last
+  std::vector<Thread> current;
+  std::vector<Thread> next;
+  // threads without start of the next step, appended to it at last
+  std::vector<Thread> next_prefix;
+  std::vector<ClosureElem> stack;
+
+  // loop frames are interned, equal counter stacks share one index
+  std::vector<LoopFrame> loops;
+  std::unordered_map<uint64_t, uint32_t> loop_index;
+
+  // visited nodes and threads of the current step, stamped to avoid
+  // clearing, paths inside loops are told apart by their frame too
+  uint32_t stamp;
+  std::vector<uint32_t> node_mark;
+  std::vector<uint32_t> slot_mark;
+  std::unordered_set<uint64_t> node_loop_mark;
+  std::unordered_set<uint64_t> slot_loop_mark;
+
+  // arrays of tag_size offsets, an array is never changed once a thread
+  // holds it, arrays no longer held are dropped once there are too many
+  size_t tag_size;
+  std::vector<size_t> capture_slots;
+  size_t capture_limit;
+  // new index of every array and the arrays kept, while collecting
+  std::vector<uint32_t> capture_map;
+  std::vector<size_t> capture_spare;
+
+  std::optional<std::pair<size_t, size_t>> best_match;
+  uint32_t best_captures;
+  // leftmost start of the paths at a MATCH_END node which only accepts at
+  // the end of input, for the offset of the last step
+  size_t end_start;
+  uint32_t end_captures;
+
+  // the best match of every pattern, and the leftmost start at the end
+  // only MATCH_END nodes of the patterns in end_patterns, empty unless the
+  // program joins many regexes
+  std::vector<std::optional<std::pair<size_t, size_t>>> pattern_match;
+  std::vector<size_t> pattern_end_start;
+  std::vector<uint32_t> end_patterns;
+
+  void next_stamp();
+
+  uint32_t push_loop(uint32_t parent, size_t count);
+
+  bool visit_node(uint32_t node, uint32_t loop);
+
+  void add_thread(
+      uint32_t edge, uint32_t progress, uint32_t loop, uint32_t captures,
+      size_t start
+  );
+
+  // the thread has consumed the character of the offset through the edge,
+  // returns whether a path accepted and the paths after it were dropped
+  bool step_edge(
+      uint32_t edge_index, uint32_t progress, uint32_t loop,
+      uint32_t captures, size_t start, size_t offset, char c
+  );
+
+  // returns whether a path accepted and the paths after it were dropped
+  bool add_closure(
+      uint32_t node, uint32_t loop, uint32_t captures, size_t start,
+      size_t offset
+  );
+
+  // a copy of the array with the tag set to the offset
+  uint32_t set_tag(uint32_t captures, uint32_t tag, size_t offset);
+
+  // drop the arrays no thread nor match holds
+  void collect_captures();
+
+  void swap_threads();
+
+  void build_slots();
+
+  void build_start_byte();
+
+  void set_pattern_match(uint32_t pattern, size_t begin, size_t end) {
+    auto &match = pattern_match[pattern];
+
+    if (
+        !match || end - begin > match->second - match->first ||
+        (end - begin == match->second - match->first && begin < match->first)
+    ) {
+      match = std::make_pair(begin, end);
+    }
+  }
+
+  // forget the paths at end only MATCH_END nodes of the last step
+  void clear_end() {
+    end_start = NO_START;
+
+    for (auto pattern : end_patterns) {
+      pattern_end_start[pattern] = NO_START;
+    }
+    end_patterns.clear();
+  }
+
+  // no path started after the best match can replace it
+  bool is_pruned(size_t start) const {
+    switch (policy) {
+      case MatchPolicy::LEFTMOST_LONGEST:
+      case MatchPolicy::LEFTMOST_FIRST:
+        return best_match && start > best_match->first;
+      case MatchPolicy::ANY:
+        return best_match.has_value();
+      default:
+        return false;
+    }
+  }
+
+  void set_match(size_t begin, size_t end, uint32_t captures) {
+    bool replace = !best_match;
+
+    if (best_match && policy != MatchPolicy::ANY) {
+      auto [best_begin, best_end] = best_match.value();
+
+      if (policy == MatchPolicy::LEFTMOST_FIRST) {
+        // the threads after an accepting path are dropped, a later match
+        // comes from a path tried before it
+        replace = true;
+      } else if (policy == MatchPolicy::LEFTMOST_LONGEST) {
+        replace = begin < best_begin || (begin == best_begin && end > best_end);
+      } else {
+        replace =
+            end - begin > best_end - best_begin ||
+            (end - begin == best_end - best_begin && begin < best_begin);
+      }
+    }
+
+    if (replace) {
+      best_match = std::make_pair(begin, end);
+      best_captures = captures;
+    }
+  }
+
+public:
+  Simulation();
+
+  // the leftmost match under the semantics of the program
+  explicit Simulation(const Program &program) :
+      Simulation{program, leftmost_policy(program)} {}
+
+  Simulation(const Program &program, MatchPolicy policy) : Simulation{} {
+    bind(program, policy);
+  }
+
+  static MatchPolicy leftmost_policy(const Program &program) {
+    return program.semantics() == MatchSemantics::LEFTMOST_FIRST ?
+        MatchPolicy::LEFTMOST_FIRST : MatchPolicy::LEFTMOST_LONGEST;
+  }
+
+  // search with another program, the memory of the state is reused
+  void bind(const Program &program, MatchPolicy policy);
+
+  // drop all threads and search from the offset
+  void start(size_t offset);
+
+  // consume the character at the offset
+  void step(size_t offset, char c);
+
+  // the input ends at the offset, the search is over
+  void finish(size_t offset);
+
+  // whether the input has a match, the scan ends at the first offset where
+  // a path accepts
+  bool accept_any(std::string_view input);
+
+  // no match attempt is running and none has matched, the state is the
+  // one start() leaves
+  bool idle() const {
+    return
+        !best_match && end_start == NO_START &&
+        (current.empty() || current.front().start == NO_START);
+  }
+
+  // the first offset from the given one where a match attempt may start,
+  // the size of the input if there is none
+  size_t skip(std::string_view input, size_t offset) const {
+    while (
+        offset < input.size() &&
+        !start_byte[static_cast<unsigned char>(input[offset])]
+    ) {
+      ++offset;
+    }
+
+    return offset;
+  }
+
+  // join the running threads of a search of the same program, started
+  // before this one and stepped to the same offset, as if one search had
+  // run from the start of the earlier one. Both must have no capture tags
+  // and no thread of the earlier one may be before MATCH_BEGIN
+  void carry(const Simulation &earlier);
+
+  // stop starting new match attempts, only the started ones are followed
+  void drop_prefix() {
+    while (!current.empty() && current.back().start == NO_START) {
+      current.pop_back();
+    }
+  }
+
+  // once no thread is left the best match is final, a path accepting only
+  // at the end of input keeps the search running until the next step
+  bool running() const { return !current.empty() || end_start != NO_START; }
+
+  const std::optional<std::pair<size_t, size_t>> &best() const {
+    return best_match;
+  }
+
+  // the best match of a pattern of a program joining many regexes
+  const std::optional<std::pair<size_t, size_t>> &
+  best(uint32_t pattern) const {
+    return pattern_match.empty() ? best_match : pattern_match[pattern];
+  }
+
+  // the offset the path of the best match recorded for the tag, NO_START
+  // if its path took no edge of the tag
+  size_t best_tag(uint32_t tag) const {
+    if (best_captures == NO_CAPTURES || tag >= tag_size) { return NO_START; }
+    return capture_slots[best_captures * tag_size + tag];
+  }
+};
+
+
+#endif // REGEX_SIMULATION
@@ -9,6 +9,7 @@
 #include <vector>
 #include <optional>
 #include <new>
+#include <limits>
 
 #include "utility.hpp"
 
@@ -133,7 +134,7 @@ public:
   }
 
   static RegexToken numeric(const std::string &name) {
-    size_t value = 0, value_max = std::numeric_limits<size_t>::max();
+    size_t value = 0, value_max = RepeatRange::BOUND_LIMIT;
 
     for (size_t i = 0; i < name.size(); ++i) {
       size_t digit = name[i] - '0';
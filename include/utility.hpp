@@ -98,6 +98,9 @@ struct CharacterRange {
 };
 
 struct RepeatRange {
+  // loop counters are stored in 32 bits, no bound of a range is above it
+  static constexpr size_t BOUND_LIMIT = UINT32_MAX - 1;
+
   size_t lower_bound; // >=1
   size_t upper_bound; // if 0 means no upperbound
 
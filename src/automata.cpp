@@ -1,146 +1,147 @@
 #include "automata.hpp"
 
-#include <unordered_map>
-
 #include "utility.hpp"
 
 
-std::optional<std::pair<size_t, size_t>> Automata::run() {
-  std::unordered_map<RegGraph::NodePtr, size_t> node_map{};
+void Automata::step_edge(const ProgramEdge &edge) {
+  auto [offset, node, index, loop, loop_size, match_start, finish] =
+      stack.back();
+  auto dest = edge.dest;
+
+  switch (Program::edge_type(edge)) {
+    case EdgeType::EMPTY:
+    case EdgeType::TAG:
+      push(offset, dest, loop, match_start);
+      break;
+    case EdgeType::ENTER_LOOP:
+      push(offset, dest, push_loop(loop, 1), match_start);
+      break;
+    case EdgeType::EXIT_LOOP:
+      if (Program::range(edge).in_range(loops[loop].count)) {
+        push(offset, dest, loops[loop].parent, match_start);
+      }
+      break;
+    case EdgeType::REPEAT: {
+      auto count = loops[loop].count + 1;
 
-  if (regex_unlikely(debug)) {
-    std::cout << "---------- [ AUTOMATA ] ----------" << std::endl;
+      if (Program::range(edge).in_upper_range(count)) {
+        auto parent = loops[loop].parent;
+        push(offset, dest, push_loop(parent, count), match_start);
+      }
+      break;
+    }
+    case EdgeType::CONCATENATION: {
+      auto string = program.string(edge);
 
-    for (auto ptr = graph.nodes.begin(); ptr != graph.nodes.end(); ++ptr) {
-      node_map.emplace(ptr, node_map.size());
+      if (input.substr(offset).rfind(string, 0) != std::string_view::npos) {
+        push(offset + string.size(), dest, loop, match_start);
+      }
+      break;
     }
+    case EdgeType::CHARACTER_SET:
+      if (offset < input.size() && program.set(edge).has_char(input[offset])) {
+        push(offset + 1, dest, loop, match_start);
+      }
+      break;
+    default:
+      regex_abort("unknown edge type");
+  }
+}
+
+bool Automata::run(MatchPolicy policy) {
+  regex_assert(policy != MatchPolicy::LEFTMOST_LONGEST);
+
+  bool exhaustive = policy == MatchPolicy::LONGEST;
+
+  if (regex_unlikely(debug)) {
+    std::cout << "---------- [ AUTOMATA ] ----------" << std::endl;
   }
 
-  stack.emplace_back(StackElem{
-    .offset = 0,
-    .node = graph.head,
-    .index = 0,
-    .loop = std::vector<size_t>{},
-    .match_start = input.size(),
-  });
+  push(0, program.head(), MatchScratch::NO_LOOP, input.size());
 
   while (!stack.empty()) {
-    auto &[offset, node, index, loop, match_start, finish] = stack.back();
+    auto &[offset, node_index, index, loop, loop_size, match_start, finish] =
+        stack.back();
+    auto &node = program.node(node_index);
 
     if (index == 0) {
       // this node is visited for the first time
-      if (node->marker == NodeMarker::MATCH_BEGIN) {
+      auto marker = program.marker(node_index);
+
+      if (marker == NodeMarker::MATCH_BEGIN) {
         if (offset < match_start) { match_start = offset; }
+      } else if (
+          marker == NodeMarker::MATCH_END && !exhaustive &&
+          (program.is_universal(node_index) || offset >= input.size())
+      ) {
+        set_match(match_start, offset, node.pattern);
+        return true;
       }
     }
 
-    if (index < node->edges.size()) {
-      auto &[edge, dest] = node->edges[index++];
+    // nodes with a dispatch table only try the edges which may accept the
+    // next input character
+    const uint32_t *dispatch_begin = nullptr;
+    size_t edge_size = node.edge_end - node.edge_begin;
+
+    if (node.dispatch != Program::NO_DISPATCH) {
+      auto slot = offset < input.size() ?
+          Node::dispatch_slot(input[offset]) : Node::DISPATCH_SLOT_SIZE - 1;
+      auto [begin, end] = program.dispatch(node, slot);
+
+      dispatch_begin = begin;
+      edge_size = end - begin;
+    }
+
+    if (index < edge_size) {
+      // the head of a regex not anchored at the start is the loop skipping
+      // the input before the match, its loop edge comes first and is tried
+      // last when stopping at the first match, so match attempts are tried
+      // from the left
+      bool skip =
+          !exhaustive && node_index == program.head() &&
+          !program.is_anchored();
+      auto position = skip ? edge_size - 1 - index : index;
+      auto edge_index = dispatch_begin ? dispatch_begin[position] : position;
+      ++index;
+
+      auto &edge = program.edge(node.edge_begin + edge_index);
 
       if (regex_unlikely(debug)) {
         std::cout
-            << node_map[node] << ' ' << index << ' ' << match_start
-            << " Edge " << "=> " << node_map[dest] << ": " << edge
-            << std::endl;
+            << node_index << ' ' << index << ' ' << match_start
+            << " Edge " << "=> " << edge.dest << ": ";
+        program.print_edge(std::cout, edge);
+        std::cout << std::endl;
       }
 
-      switch (edge.type) {
-        case EdgeType::EMPTY:
-          stack.emplace_back(StackElem{
-            .offset = offset,
-            .node = dest,
-            .index = 0,
-            .loop = loop,
-            .match_start = match_start,
-          });
-          break;
-        case EdgeType::ENTER_LOOP: {
-          auto new_loop = loop;
-          new_loop.emplace_back(1);
-
-          stack.emplace_back(StackElem{
-            .offset = offset,
-            .node = dest,
-            .index = 0,
-            .loop = std::move(new_loop),
-            .match_start = match_start,
-          });
-          break;
-        }
-        case EdgeType::EXIT_LOOP: {
-          auto new_loop = loop;
-          if (edge.range.in_range(new_loop.back())) {
-            new_loop.pop_back();
-            stack.emplace_back(StackElem{
-              .offset = offset,
-              .node = dest,
-              .index = 0,
-              .loop = std::move(new_loop),
-              .match_start = match_start,
-            });
-          }
-          break;
-        }
-        case EdgeType::REPEAT: {
-          auto new_loop = loop;
-
-          if (edge.range.in_upper_range(++new_loop.back())) {
-            stack.emplace_back(StackElem{
-              .offset = offset,
-              .node = dest,
-              .index = 0,
-              .loop = std::move(new_loop),
-              .match_start = match_start,
-            });
-          }
-          break;
-        }
-        case EdgeType::CONCATENATION:
-          if (
-              input.substr(offset).rfind(edge.string, 0) !=
-              std::string_view::npos
-          ) {
-            stack.emplace_back(StackElem{
-              .offset = offset + edge.string.size(),
-              .node = dest,
-              .index = 0,
-              .loop = loop,
-              .match_start = match_start,
-            });
-          }
-
-          break;
-        case EdgeType::CHARACTER_SET:
-          if (offset < input.size() && edge.set.has_char(input[offset])) {
-              stack.emplace_back(StackElem{
-              .offset = offset + 1,
-              .node = dest,
-              .index = 0,
-              .loop = loop,
-              .match_start = match_start,
-            });
-          }
-          break;
-        default:
-          regex_abort("unknown edge type");
-      }
+      step_edge(edge);
     } else {
       if (regex_unlikely(debug)) {
         std::cout
-            << node_map[node] << ' ' << index << ' ' << match_start
+            << node_index << ' ' << index << ' ' << match_start
             << " Leaving" << std::endl;
       }
 
-      finish |= offset >= input.length();
+      if (exhaustive) {
+        finish |= offset >= input.length();
 
-      if (node->marker == NodeMarker::MATCH_END) {
-        if (finish) { set_match(match_start, offset); }
+        if (program.marker(node_index) == NodeMarker::MATCH_END && finish) {
+          set_match(match_start, offset, node.pattern);
+        }
       }
 
+      bool leaving_finish = finish;
+
+      // loop frames pushed by this element are no longer referenced
+      loops.resize(loop_size);
+
       stack.pop_back();
-      if (!stack.empty()) { stack.back().finish |= finish; }
+      if (exhaustive && !stack.empty()) {
+        stack.back().finish |= leaving_finish;
+      }
     }
   }
 
-  return best_match;
+  return false;
 }
@@ -0,0 +1,472 @@
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utility.hpp"
+#include "regex.hpp"
+#include "bounded_queue.hpp"
+
+
+/* regex-grep [-c | -l] [-j THREADS] REGEX [FILE...]
+
+   Prints the lines of the files matching the regex. A file is mapped and
+   split into chunks ending at a newline, the chunks are matched on all
+   cores and their lines are printed in the order of the file.
+
+   Input which cannot be mapped, the standard input without files or "-",
+   pipes and other special files, is read in a pipeline: a reader fills
+   recycled buffers, workers match the whole lines of the buffers, and the
+   results are printed in order. The stages pass buffers through bounded
+   queues, so memory stays fixed however long the input is.
+
+   -c  print the number of matching lines of every file
+   -l  print the name of every file with a matching line
+   -j  number of matching threads, all cores by default */
+
+constexpr size_t CHUNK_SIZE = 1 << 20;
+constexpr size_t BUFFER_SIZE = 1 << 20;
+
+enum class OutputMode { LINES, COUNT, FILES };
+
+struct Options {
+  OutputMode mode{OutputMode::LINES};
+  bool print_name{false};
+  size_t thread_size{0};
+};
+
+struct MappedInput {
+  const char *data;
+  size_t size;
+
+  MappedInput() : data{nullptr}, size{0} {}
+
+  MappedInput(const MappedInput &other) = delete;
+
+  MappedInput &operator=(const MappedInput &other) = delete;
+
+  ~MappedInput() {
+    if (data != nullptr) { munmap(const_cast<char *>(data), size); }
+  }
+
+  // the file must be a regular file
+  bool map(int fd, size_t file_size) {
+    size = file_size;
+
+    if (size != 0) {
+      auto address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (address == MAP_FAILED) { return false; }
+
+      madvise(address, size, MADV_SEQUENTIAL);
+      data = static_cast<const char *>(address);
+    }
+
+    return true;
+  }
+};
+
+// a buffer of the pipeline, recycled once its output is printed
+struct Batch {
+  std::unique_ptr<char[]> data{};
+  size_t capacity{0};
+  size_t size{0};
+  size_t sequence{0};
+  // the input ends with this batch
+  bool last{false};
+  std::string output{};
+  size_t count{0};
+
+  // the first size bytes are kept, they must fit the new capacity
+  void reallocate(size_t new_capacity) {
+    auto new_data = std::make_unique<char[]>(new_capacity);
+    std::copy(data.get(), data.get() + size, new_data.get());
+    data = std::move(new_data);
+    capacity = new_capacity;
+  }
+};
+
+struct ChunkResult {
+  std::string output{};
+  size_t count{0};
+  bool done{false};
+};
+
+// the offsets of the chunks, every chunk but the last ends after a newline
+std::vector<size_t> split_chunks(std::string_view input) {
+  std::vector<size_t> bounds{0};
+
+  while (bounds.back() < input.size()) {
+    auto end = bounds.back() + CHUNK_SIZE;
+
+    if (end >= input.size()) {
+      end = input.size();
+    } else {
+      auto newline = input.find('\n', end);
+      end = newline == std::string_view::npos ? input.size() : newline + 1;
+    }
+
+    bounds.push_back(end);
+  }
+
+  return bounds;
+}
+
+// returns the number of matching lines, their text is appended to output
+// unless only counting
+size_t grep_chunk(
+    const Regex &regex, std::string_view chunk, const Options &options,
+    std::string_view name, std::string &output
+) {
+  size_t count = 0;
+
+  while (!chunk.empty()) {
+    auto newline = chunk.find('\n');
+    auto line = chunk.substr(0, newline);
+
+    chunk.remove_prefix(
+        newline == std::string_view::npos ? chunk.size() : newline + 1
+    );
+
+    if (!regex.is_match(line)) { continue; }
+
+    ++count;
+
+    if (options.mode == OutputMode::FILES) { break; }
+
+    if (options.mode == OutputMode::LINES) {
+      if (options.print_name) { output.append(name).push_back(':'); }
+      output.append(line).push_back('\n');
+    }
+  }
+
+  return count;
+}
+
+// returns the number of matching lines of the file
+size_t grep_file(
+    const Regex &regex, std::string_view input, const Options &options,
+    std::string_view name, size_t thread_size
+) {
+  auto bounds = split_chunks(input);
+  auto chunk_size = bounds.size() - 1;
+
+  std::vector<ChunkResult> results(chunk_size);
+  std::atomic<size_t> next_chunk{0};
+  std::atomic<bool> found{false};
+  std::mutex mutex{};
+  std::condition_variable chunk_done{};
+
+  auto worker = [&]() {
+    std::string output{};
+
+    while (true) {
+      auto index = next_chunk.fetch_add(1, std::memory_order_relaxed);
+      if (index >= chunk_size) { break; }
+
+      size_t count = 0;
+
+      // listing the file only needs one matching line
+      if (options.mode != OutputMode::FILES || !found.load()) {
+        auto chunk = input.substr(
+            bounds[index], bounds[index + 1] - bounds[index]
+        );
+        count = grep_chunk(regex, chunk, options, name, output);
+        if (count != 0) { found.store(true); }
+      }
+
+      std::lock_guard guard{mutex};
+
+      results[index].output.swap(output);
+      results[index].count = count;
+      results[index].done = true;
+      chunk_done.notify_all();
+
+      output.clear();
+    }
+  };
+
+  std::vector<std::thread> threads{};
+
+  for (size_t i = 1; i < std::min(thread_size, chunk_size); ++i) {
+    threads.emplace_back(worker);
+  }
+
+  // the chunks are printed in order while the workers match the next ones
+  std::thread printer{[&]() {
+    for (auto &result : results) {
+      std::unique_lock lock{mutex};
+      chunk_done.wait(lock, [&]() { return result.done; });
+
+      auto output = std::move(result.output);
+      lock.unlock();
+
+      fwrite(output.data(), 1, output.size(), stdout);
+    }
+  }};
+
+  worker();
+
+  for (auto &thread : threads) { thread.join(); }
+  printer.join();
+
+  size_t count = 0;
+  for (auto &result : results) { count += result.count; }
+
+  return count;
+}
+
+// returns the number of matching lines of the input, or nothing if it
+// cannot be read
+std::optional<size_t> grep_pipe(
+    const Regex &regex, int fd, const Options &options,
+    std::string_view name, size_t thread_size
+) {
+  // enough buffers for every worker to hold one while one more is being
+  // read and one is being printed
+  size_t batch_size = 2 * thread_size + 2;
+
+  std::vector<Batch> batches(batch_size);
+  BoundedQueue<Batch *> free_batches{batch_size};
+  BoundedQueue<Batch *> work{batch_size};
+  // a matched batch waits at the slot of its sequence until it is printed,
+  // the batches in flight never outnumber the slots
+  std::vector<std::atomic<Batch *>> slots(batch_size);
+  std::atomic<bool> found{false};
+  bool failed = false;
+
+  for (auto &batch : batches) {
+    batch.data = std::make_unique<char[]>(BUFFER_SIZE);
+    batch.capacity = BUFFER_SIZE;
+    free_batches.push(&batch);
+  }
+
+  // lines are cut at the last newline of a buffer, the partial line left
+  // is moved to the next buffer
+  std::thread reader{[&]() {
+    std::string carry{};
+    size_t sequence = 0;
+    bool end = false;
+
+    while (!end) {
+      auto batch = free_batches.pop();
+
+      // a batch grown for a long line goes back to the usual size once
+      // the line is passed
+      auto capacity = std::max(BUFFER_SIZE, carry.size() * 2);
+
+      batch->size = 0;
+      if (batch->capacity != capacity) { batch->reallocate(capacity); }
+
+      std::copy(carry.begin(), carry.end(), batch->data.get());
+      batch->size = carry.size();
+      carry.clear();
+      if (carry.capacity() > BUFFER_SIZE) { carry.shrink_to_fit(); }
+
+      // a pipe returns what is available, a batch is passed on as soon as
+      // it holds a whole line to keep the output of a slow pipe timely
+      while (true) {
+        auto result = read(
+            fd, batch->data.get() + batch->size,
+            batch->capacity - batch->size
+        );
+
+        if (result < 0 && errno == EINTR) { continue; }
+
+        if (result <= 0) {
+          failed = result < 0;
+          end = true;
+          break;
+        }
+
+        std::string_view data{
+            batch->data.get() + batch->size, static_cast<size_t>(result)
+        };
+        batch->size += result;
+
+        if (data.find('\n') != std::string_view::npos) { break; }
+
+        // a line longer than the buffer
+        if (batch->size == batch->capacity) {
+          batch->reallocate(batch->capacity * 2);
+        }
+      }
+
+      if (!end) {
+        std::string_view data{batch->data.get(), batch->size};
+        auto line_end = data.rfind('\n') + 1;
+
+        carry.assign(data.substr(line_end));
+        batch->size = line_end;
+      }
+
+      batch->sequence = sequence++;
+      batch->last = end;
+      work.push(batch);
+    }
+
+    for (size_t i = 0; i < thread_size; ++i) { work.push(nullptr); }
+  }};
+
+  auto worker = [&]() {
+    while (auto batch = work.pop()) {
+      batch->output.clear();
+      batch->count = 0;
+
+      if (options.mode != OutputMode::FILES || !found.load()) {
+        batch->count = grep_chunk(
+            regex, std::string_view{batch->data.get(), batch->size}, options,
+            name, batch->output
+        );
+        if (batch->count != 0) { found.store(true); }
+      }
+
+      auto &slot = slots[batch->sequence % batch_size];
+      slot.store(batch, std::memory_order_release);
+      slot.notify_one();
+    }
+  };
+
+  std::vector<std::thread> threads{};
+
+  for (size_t i = 0; i < thread_size; ++i) { threads.emplace_back(worker); }
+
+  size_t count = 0;
+
+  for (size_t sequence = 0;; ++sequence) {
+    auto &slot = slots[sequence % batch_size];
+
+    slot.wait(nullptr, std::memory_order_acquire);
+    auto batch = slot.exchange(nullptr, std::memory_order_acquire);
+
+    fwrite(batch->output.data(), 1, batch->output.size(), stdout);
+    fflush(stdout);
+    count += batch->count;
+
+    bool last = batch->last;
+    free_batches.push(batch);
+
+    if (last) { break; }
+  }
+
+  reader.join();
+  for (auto &thread : threads) { thread.join(); }
+
+  if (failed) { return std::nullopt; }
+  return count;
+}
+
+int main(int argc, const char **argv) {
+  Options options{};
+  int index = 1;
+
+  for (; index < argc && argv[index][0] == '-'; ++index) {
+    std::string_view option{argv[index]};
+
+    if (option == "-c") {
+      options.mode = OutputMode::COUNT;
+    } else if (option == "-l") {
+      options.mode = OutputMode::FILES;
+    } else if (option == "-j" && index + 1 < argc) {
+      options.thread_size = std::strtoul(argv[++index], nullptr, 10);
+    } else if (option == "--") {
+      ++index;
+      break;
+    } else {
+      std::cerr << "unknown option " << option << std::endl;
+      return 2;
+    }
+  }
+
+  if (argc - index < 1) {
+    std::cerr
+        << "usage: regex-grep [-c | -l] [-j THREADS] REGEX [FILE...]"
+        << std::endl;
+    return 2;
+  }
+
+  auto regex = Regex::init(argv[index++]);
+  if (!regex) { return 2; }
+
+  std::vector<const char *> paths{argv + index, argv + argc};
+  if (paths.empty()) { paths.push_back("-"); }
+
+  options.print_name = paths.size() > 1;
+
+  size_t thread_size = options.thread_size != 0 ?
+      options.thread_size :
+      std::max(1u, std::thread::hardware_concurrency());
+  bool matched = false;
+  bool failed = false;
+
+  static char buffer[1 << 16];
+  setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+
+  for (auto path : paths) {
+    std::string_view name{path};
+    int fd = STDIN_FILENO;
+    // only the files opened here are closed, the standard input is not
+    bool opened = false;
+
+    if (name == "-") {
+      name = "(standard input)";
+    } else {
+      fd = open(path, O_RDONLY);
+      opened = fd >= 0;
+    }
+
+    struct stat status{};
+
+    if (fd < 0 || fstat(fd, &status) != 0) {
+      std::cerr << "cannot read " << path << std::endl;
+      if (opened) { close(fd); }
+      failed = true;
+      continue;
+    }
+
+    std::optional<size_t> count{};
+    MappedInput input{};
+
+    if (S_ISREG(status.st_mode) && input.map(fd, status.st_size)) {
+      count = grep_file(
+          regex.value(), std::string_view{input.data, input.size}, options,
+          name, thread_size
+      );
+    } else {
+      count = grep_pipe(regex.value(), fd, options, name, thread_size);
+    }
+
+    if (opened) { close(fd); }
+
+    if (!count) {
+      std::cerr << "cannot read " << path << std::endl;
+      failed = true;
+      continue;
+    }
+
+    matched |= count.value() != 0;
+
+    if (options.mode == OutputMode::COUNT) {
+      if (options.print_name) { printf("%s:", name.data()); }
+      printf("%zu\n", count.value());
+    } else if (options.mode == OutputMode::FILES && count.value() != 0) {
+      printf("%s\n", name.data());
+    }
+  }
+
+  fflush(stdout);
+
+  return failed ? 2 : matched ? 0 : 1;
+}
@@ -4,11 +4,36 @@
 #include <sstream>
 #include <filesystem>
 #include <optional>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <cstdio>
 
 #include "utility.hpp"
 #include "regex.hpp"
+#include "regex_set.hpp"
+#include "regex_handle.hpp"
+#include "regex_cache.hpp"
 
 
+// every allocation of the runner is counted, to check matching allocates
+// nothing once its scratch is warm
+static std::atomic<size_t> allocation_size{0};
+
+void *operator new(size_t size) {
+  ++allocation_size;
+
+  if (auto pointer = std::malloc(size == 0 ? 1 : size)) { return pointer; }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+
 std::string escape_string(std::string string) {
   std::string result{};
 
@@ -35,8 +60,137 @@ std::string escape_string(std::string string) {
   return result;
 }
 
+using MatchRange = std::pair<size_t, size_t>;
+
+void check_same(
+    const std::optional<MatchRange> &result,
+    const std::optional<MatchRange> &expect, const std::string &name
+) {
+  if (result == expect) { return; }
+
+  std::cout << name << ": ";
+  if (result) {
+    std::cout << result->first << ' ' << result->second - result->first;
+  } else {
+    std::cout << "NO_MATCH";
+  }
+  std::cout << std::endl;
+
+  regex_warn(name + " match error");
+}
+
+// the matches of a coroutine task resumed with buffers of the size
+std::vector<MatchRange> task_matches(
+    const Regex &regex, std::string_view input, size_t size
+) {
+  std::vector<MatchRange> result{};
+  auto task = regex.match_task();
+
+  for (size_t i = 0; i < input.size(); i += size) {
+    task.push(input.substr(i, size));
+    while (auto match = task.next()) { result.push_back(match.value()); }
+  }
+
+  task.close();
+  while (auto match = task.next()) { result.push_back(match.value()); }
+
+  if (!task.done()) { regex_warn("task done error"); }
+
+  return result;
+}
+
+// every other way to match the input must agree with match()
+void cross_check(
+    const Regex &regex, const Regex &loaded, const std::string &input
+) {
+  auto match = regex.match(input);
+
+  std::optional<MatchRange> found{};
+  if (regex.is_match(input)) { found = match.value_or(MatchRange{0, 0}); }
+  check_same(found, match, "is_match");
+
+  check_same(loaded.match(input), match, "loaded");
+
+  // every engine able to match the regex finds the same match, the
+  // backtracking one is given the whole input
+  for (auto engine : {
+      MatchEngine::LITERAL, MatchEngine::REVERSE, MatchEngine::SPLIT,
+      MatchEngine::BACKTRACK, MatchEngine::SIMULATION
+  }) {
+    if (!regex.supports(engine)) { continue; }
+
+    MatchPlan plan{};
+    plan.engine = engine;
+    plan.backtrack_limit = input.size();
+
+    auto other = regex.with_plan(plan).value();
+
+    std::stringstream name{};
+    name << "plan " << plan;
+
+    check_same(other.match(input), match, name.str());
+
+    found.reset();
+    if (other.is_match(input)) { found = match.value_or(MatchRange{0, 0}); }
+    check_same(found, match, name.str() + " is_match");
+  }
+
+  std::optional<MatchRange> captured{};
+  if (auto captures = regex.captures(input)) { captured = captures.value()[0]; }
+  check_same(captured, match, "captures");
+
+  std::vector<std::string_view> segments{};
+  for (size_t i = 0; i < input.size(); ++i) {
+    segments.emplace_back(input.data() + i, 1);
+  }
+  check_same(regex.match(segments), match, "segments");
+
+  check_same(regex.match_parallel(input, 4), match, "match_parallel");
+
+  // a stream fed one byte at a time finds the matches of a stream fed the
+  // whole input, the first one exists if the input has a match
+  auto stream_matches = [&regex](const std::string &input, size_t size) {
+    std::vector<MatchRange> result{};
+    auto stream = regex.stream();
+
+    for (size_t i = 0; i < input.size(); i += size) {
+      auto &fed = stream.feed(std::string_view{input}.substr(i, size));
+      result.insert(result.end(), fed.begin(), fed.end());
+    }
+
+    auto &rest = stream.finish();
+    result.insert(result.end(), rest.begin(), rest.end());
+    return result;
+  };
+
+  // the leftmost matches, the first one exists if the input has a match
+  std::vector<MatchRange> matches{};
+  regex.find_all(input, matches);
+
+  if (matches.empty() != !match.has_value()) {
+    regex_warn("find_all match error");
+  }
+
+  if (regex.count(input) != matches.size()) {
+    regex_warn("count match error");
+  }
+
+  auto streamed = stream_matches(input, 1);
+
+  if (
+      streamed != stream_matches(input, input.size() + 1) ||
+      streamed != matches
+  ) {
+    regex_warn("stream match error");
+  }
+
+  if (task_matches(regex, input, 3) != streamed) {
+    regex_warn("task match error");
+  }
+}
+
 void test_match(
-    Regex &regex, std::string input,
+    const Regex &regex, const Regex &loaded, std::string input,
     size_t expect_start, size_t expect_size
 ) {
   std::cout << "========== [ MATCHING ] ==========" << std::endl;
@@ -74,12 +228,535 @@ void test_match(
     }
   }
 
+  cross_check(regex, loaded, input);
+
   std::cout << std::endl;
 }
 
+// merging the nodes of a large alternation of strings must take time
+// close to linear in the number of alternatives
+void test_large_alternation() {
+  constexpr size_t ALTERNATIVE_SIZE = 4000;
+
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING ALTERNATION: " << ALTERNATIVE_SIZE << " strings"
+      << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  std::vector<std::string> strings{};
+  std::string source{};
+  uint32_t seed = 1;
+
+  for (size_t i = 0; i < ALTERNATIVE_SIZE; ++i) {
+    std::string string{};
+
+    for (size_t j = 0; j < 4 + i % 8; ++j) {
+      seed = seed * 1103515245 + 12345;
+      string.push_back('a' + (seed >> 16) % 26);
+    }
+
+    if (i != 0) { source.push_back('|'); }
+    source.append(string);
+    strings.emplace_back(std::move(string));
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  auto regex = Regex::init(source);
+  auto seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - begin
+  ).count();
+
+  if (seconds > 1) { regex_warn("alternation compile time error"); }
+
+  if (!regex) {
+    regex_warn("expect parse success");
+    return;
+  }
+
+  for (auto &string : strings) {
+    if (!regex->is_match(string)) { regex_warn("alternation match error"); }
+  }
+}
+
+// hits, misses, the least recently used entry of a full shard evicted,
+// the semantics in the key and invalid regexes never cached
+void test_cache() {
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING CACHE" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  auto expect = [](bool condition, const char *message) {
+    if (!condition) { regex_warn(message); }
+  };
+
+  RegexCache cache{};
+
+  auto first = cache.get("a+b");
+  auto again = cache.get("a+b");
+  auto stats = cache.statistics();
+
+  expect(first && first == again, "cache hit error");
+  expect(stats.hit == 1 && stats.miss == 1 && stats.size == 1,
+         "cache statistics error");
+
+  auto leftmost_first = cache.get("a+b", MatchSemantics::LEFTMOST_FIRST);
+  stats = cache.statistics();
+
+  expect(
+      leftmost_first && leftmost_first != first &&
+      leftmost_first->semantics() == MatchSemantics::LEFTMOST_FIRST,
+      "cache semantics error"
+  );
+  expect(stats.miss == 2 && stats.size == 2, "cache semantics error");
+
+  expect(cache.get("a(") == nullptr, "cache invalid regex error");
+  expect(cache.get("a(") == nullptr, "cache invalid regex error");
+  stats = cache.statistics();
+  expect(stats.miss == 4 && stats.size == 2, "cache invalid regex error");
+
+  // with one entry per shard, a regex evicting the first one shares its
+  // shard
+  cache.set_capacity(RegexCache::SHARD_SIZE);
+
+  std::vector<std::string> same_shard{"x0"};
+
+  for (size_t i = 1; same_shard.size() < 3; ++i) {
+    auto regex = "x" + std::to_string(i);
+
+    cache.clear();
+    cache.get(same_shard.front());
+
+    auto eviction = cache.statistics().eviction;
+    cache.get(regex);
+    if (cache.statistics().eviction != eviction) {
+      same_shard.emplace_back(regex);
+    }
+  }
+
+  // two entries per shard, using the first one again makes the second one
+  // the least recently used
+  cache.clear();
+  cache.set_capacity(RegexCache::SHARD_SIZE * 2);
+
+  cache.get(same_shard[0]);
+  cache.get(same_shard[1]);
+  cache.get(same_shard[0]);
+  cache.get(same_shard[2]);
+
+  auto hit = cache.statistics().hit;
+  cache.get(same_shard[0]);
+  expect(cache.statistics().hit == hit + 1, "cache eviction error");
+
+  auto miss = cache.statistics().miss;
+  cache.get(same_shard[1]);
+  expect(cache.statistics().miss == miss + 1, "cache eviction error");
+}
+
+// a scratch bound again to the same regex allocates nothing, the state
+// of the Simulation is kept from the match before
+void test_scratch() {
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING SCRATCH" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  const std::pair<const char *, const char *> cases[] = {
+    {"a[0-9]*b", "xxxa0123456789bxx"},
+    {"(foo|bar)+baz", "xfoobarfoobaz"},
+    {"[a-z]+@[a-z]+\\.com", "mail: someone@example.com."},
+  };
+
+  for (auto [source, input] : cases) {
+    // the default plan is stepped by the Simulation
+    auto regex = Regex::init(source)->with_plan(MatchPlan{}).value();
+    MatchScratch scratch{};
+
+    auto expect = regex.match(input, scratch);
+    auto allocated = allocation_size.load();
+
+    for (size_t i = 0; i < 16; ++i) {
+      if (regex.match(input, scratch) != expect) {
+        regex_warn("scratch match error");
+      }
+    }
+
+    if (allocation_size.load() != allocated) {
+      std::cout << source << ": " << allocation_size.load() - allocated
+          << " allocations" << std::endl;
+
+      regex_warn("scratch allocation error");
+    }
+  }
+}
+
+// the groups of a path are reported, a group the path did not take has no
+// range and a group inside a loop holds its last iteration
+void test_captures() {
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING CAPTURES" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  using Group = std::optional<MatchRange>;
+
+  const struct {
+    const char *source;
+    MatchSemantics semantics;
+    const char *input;
+    Regex::Captures expect;
+  } cases[] = {
+    {"(a)|b", MatchSemantics::LONGEST, "b", {MatchRange{0, 1}, Group{}}},
+    {"x(a)?y", MatchSemantics::LEFTMOST_FIRST, "xy",
+        {MatchRange{0, 2}, Group{}}},
+    {"(a|b)+", MatchSemantics::LONGEST, "ab",
+        {MatchRange{0, 2}, MatchRange{1, 2}}},
+    {"(a)*", MatchSemantics::LEFTMOST_FIRST, "aab",
+        {MatchRange{0, 2}, MatchRange{1, 2}}},
+    // the longest match takes the longer alternative, the first one ends
+    // at the first alternative
+    {"(a|ab)(c|bcd)?", MatchSemantics::LONGEST, "abc",
+        {MatchRange{0, 3}, MatchRange{0, 2}, MatchRange{2, 3}}},
+    {"(a|ab)(c|bcd)?", MatchSemantics::LEFTMOST_FIRST, "abc",
+        {MatchRange{0, 1}, MatchRange{0, 1}, Group{}}},
+    {"(a*)(a*)", MatchSemantics::LONGEST, "aa",
+        {MatchRange{0, 2}, MatchRange{0, 2}, MatchRange{2, 2}}},
+  };
+
+  for (auto &[source, semantics, input, expect] : cases) {
+    auto regex = Regex::init(source, semantics).value();
+    auto captures = regex.captures(input);
+
+    if (regex.capture_size() != expect.size() || captures != expect) {
+      std::cout << source << ": " << input << std::endl;
+      regex_warn("captures match error");
+    }
+  }
+}
+
+// a stream keeps no input of an attempt which has not matched yet, however
+// long the attempt runs
+void test_stream() {
+  constexpr size_t CHUNK_SIZE = 1 << 12;
+  constexpr size_t CHUNK_COUNT = 1 << 10;
+
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING STREAM: " << CHUNK_SIZE * CHUNK_COUNT << " bytes"
+      << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  auto regex = Regex::init("a[0-9]*b").value();
+  auto stream = regex.stream();
+  std::string chunk(CHUNK_SIZE, '7');
+  size_t buffered = 0;
+
+  chunk[0] = 'a';
+  stream.feed(chunk);
+  chunk[0] = '7';
+
+  for (size_t i = 1; i < CHUNK_COUNT; ++i) {
+    stream.feed(chunk);
+    buffered = std::max(buffered, stream.buffered());
+  }
+
+  auto &matches = stream.feed("b");
+  auto expect = MatchRange{0, CHUNK_SIZE * CHUNK_COUNT + 1};
+
+  if (matches.size() != 1 || matches.front() != expect) {
+    regex_warn("stream match error");
+  }
+
+  if (buffered > CHUNK_SIZE) {
+    std::cout << "buffered: " << buffered << std::endl;
+    regex_warn("stream buffer error");
+  }
+}
+
+// a task resumed with buffers finds the match of the joined input, the
+// match spans three buffers
+void test_task() {
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING TASK" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  auto regex = Regex::init("ab+c").value();
+  std::string input = "xxabbbbcxx";
+
+  auto matches = task_matches(regex, input, 4);
+
+  if (matches.size() != 1 || matches.front() != regex.match(input)) {
+    regex_warn("task match error");
+  }
+}
+
+// the counts of regex-grep -c on a file, mapped in chunks, and on a pipe,
+// read in buffers, must be the number of lines is_match accepts
+void test_grep(const std::filesystem::path &grep) {
+  constexpr size_t LINE_SIZE = 1 << 16;
+
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING GREP: " << LINE_SIZE << " lines" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  const char *users[] = {"alice", "bob", "carol", "dave"};
+  const char *methods[] = {"GET", "PUT"};
+
+  auto path = std::filesystem::temp_directory_path() / "regex_grep.txt";
+  std::vector<std::string> lines{};
+  uint32_t seed = 1;
+
+  {
+    std::ofstream file{path, std::ios::binary};
+
+    for (size_t i = 0; i < LINE_SIZE; ++i) {
+      seed = seed * 1103515245 + 12345;
+
+      auto line =
+          std::to_string(seed % 100000) + " user=" + users[seed % 4] + " " +
+          methods[(seed >> 8) % 2] + " /item/a" + std::to_string(seed % 7) +
+          (seed % 5 == 0 ? "b" : "c");
+
+      // a line longer than a buffer of the pipe
+      if (i == LINE_SIZE / 2) { line.append(3 << 20, 'x'); }
+
+      file << line << '\n';
+      lines.emplace_back(std::move(line));
+    }
+  }
+
+  auto run = [](const std::string &command) -> std::optional<size_t> {
+    auto pipe = popen(command.c_str(), "r");
+    if (pipe == nullptr) { return std::nullopt; }
+
+    size_t count = 0;
+    bool read = fscanf(pipe, "%zu", &count) == 1;
+
+    if (pclose(pipe) == -1 || !read) { return std::nullopt; }
+    return count;
+  };
+
+  for (
+      auto source : {
+        "user=(alice|bob) GET", "^[0-9]+ user", "a[0-9]*b$", "x{3}$", "zzz"
+      }
+  ) {
+    auto regex = Regex::init(source).value();
+    size_t expect = 0;
+
+    for (auto &line : lines) { expect += regex.is_match(line); }
+
+    auto grep_command =
+        grep.string() + " -c -j 3 '" + source + "' ";
+    auto from_file = run(grep_command + path.string());
+    auto from_pipe = run("cat " + path.string() + " | " + grep_command);
+
+    if (from_file != expect || from_pipe != expect) {
+      std::cout
+          << source << ": expect " << expect
+          << ", file " << from_file.value_or(-1)
+          << ", pipe " << from_pipe.value_or(-1) << std::endl;
+
+      regex_warn("grep count error");
+    }
+  }
+
+  std::filesystem::remove(path);
+}
+
+// an input of many chunks matched in parallel, the matches span the ends
+// of chunks, every regex is stepped by the Simulation
+void test_parallel() {
+  constexpr size_t CHUNK_SIZE = 1 << 16;
+  constexpr size_t INPUT_SIZE = CHUNK_SIZE * 6 + 123;
+
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING PARALLEL: " << INPUT_SIZE << " bytes" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  std::string input(INPUT_SIZE, 'x');
+  uint32_t seed = 1;
+
+  for (auto &c : input) {
+    seed = seed * 1103515245 + 12345;
+    c = "xab0"[(seed >> 16) % 4];
+  }
+
+  // a short match before the end of the first chunk, and a long one from
+  // the second chunk to the fifth
+  input.replace(CHUNK_SIZE - 2, 4, "a12b");
+  input[CHUNK_SIZE * 2 - 5] = 'a';
+  for (size_t i = CHUNK_SIZE * 2 - 4; i < CHUNK_SIZE * 4 + 7; ++i) {
+    input[i] = '0' + i % 10;
+  }
+  input[CHUNK_SIZE * 4 + 7] = 'b';
+
+  for (
+      auto semantics : {MatchSemantics::LONGEST, MatchSemantics::LEFTMOST_FIRST}
+  ) {
+    for (auto source : {"a[0-9]+b", "a[0-9]*b|b0", "[ab][0-9]{10,}", "(ab|x)+"}) {
+      auto regex =
+          Regex::init(source, semantics)->with_plan(MatchPlan{}).value();
+      auto expect = regex.match(input);
+
+      for (size_t thread_size : {2, 3, 7}) {
+        check_same(
+            regex.match_parallel(input, thread_size), expect,
+            std::string{source} + " match_parallel"
+        );
+      }
+    }
+  }
+}
+
+// the regex read back from its saved image
+std::optional<Regex> save_and_load(const Regex &regex) {
+  auto path = std::filesystem::temp_directory_path() / "regex_test.bin";
+
+  {
+    std::ofstream file{path, std::ios::binary};
+    regex.save(file);
+  }
+
+  auto regexes = Regex::load(path);
+  std::filesystem::remove(path);
+
+  if (!regexes || regexes->size() != 1) {
+    regex_warn("load error");
+    return std::nullopt;
+  }
+
+  return std::move(regexes->front());
+}
+
+// a set of the regexes built by adding and removing them must match every
+// input as the regexes one by one
+void test_set(
+    const std::vector<std::string> &sources,
+    const std::vector<std::string> &inputs
+) {
+  if (sources.empty()) { return; }
+
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING SET: " << sources.size() << " regexes" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  std::vector<Regex> regexes{};
+  std::vector<std::string_view> first_half{};
+
+  for (size_t i = 0; i < sources.size(); ++i) {
+    regexes.emplace_back(Regex::init(sources[i]).value());
+    if (i < sources.size() / 2) { first_half.emplace_back(sources[i]); }
+  }
+
+  auto set = RegexSet::init(first_half);
+  if (!set) {
+    regex_warn("set init error");
+    return;
+  }
+
+  for (size_t i = first_half.size(); i < sources.size(); ++i) {
+    if (set->add(sources[i]) != i) { regex_warn("set add error"); }
+  }
+
+  for (size_t i = 0; i < sources.size(); i += 3) {
+    if (!set->remove(i) || set->contains(i)) {
+      regex_warn("set remove error");
+    }
+  }
+
+  for (auto &input : inputs) {
+    auto results = set->match(input);
+    auto matched = set->matches(input);
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+      std::optional<MatchRange> expect{};
+      if (set->contains(i)) { expect = regexes[i].match(input); }
+
+      if (results[i] != expect || matched[i] != expect.has_value()) {
+        std::cout
+            << make_escape(sources[i]) << ", "
+            << make_escape(input) << std::endl;
+
+        regex_warn("set match error");
+      }
+    }
+  }
+}
+
+// readers matching through a handle while it is published again and again
+// see one of the versions, every version is deleted once no reader holds it
+void test_handle() {
+  std::cout
+      << "+---------------------------------------" << std::endl
+      << "| TESTING HANDLE" << std::endl
+      << "+---------------------------------------" << std::endl
+      << std::endl;
+
+  static std::atomic<size_t> deleted{0};
+
+  struct Version {
+    Regex regex;
+
+    ~Version() { ++deleted; }
+  };
+
+  auto make_version = [](const char *source) {
+    return std::make_unique<const Version>(Regex::init(source).value());
+  };
+
+  constexpr size_t PUBLISH_SIZE = 200;
+
+  RegexHandle<Version> handle{make_version("a+")};
+  std::atomic<bool> done{false};
+
+  auto reader = [&handle, &done]() {
+    while (!done.load()) {
+      auto guard = handle.read();
+      auto match = guard->regex.match("baaa");
+
+      if (match != MatchRange{1, 4} && match != MatchRange{0, 1}) {
+        regex_warn("handle match error");
+      }
+    }
+  };
+
+  std::vector<std::thread> readers{};
+  for (size_t i = 0; i < 4; ++i) { readers.emplace_back(reader); }
+
+  for (size_t i = 0; i < PUBLISH_SIZE; ++i) {
+    handle.publish(make_version(i % 2 == 0 ? "b" : "a+"));
+  }
+
+  done.store(true);
+  for (auto &thread : readers) { thread.join(); }
+
+  handle.reclaim();
+
+  if (deleted.load() != PUBLISH_SIZE) { regex_warn("handle reclaim error"); }
+}
+
 void test_file(std::istream &stream) {
   std::string buffer{};
   std::optional<Regex> regex{std::nullopt};
+  std::optional<Regex> loaded{std::nullopt};
+  // the regexes of the longest semantics and all inputs, matched as a set
+  std::vector<std::string> set_sources{};
+  std::vector<std::string> set_inputs{};
 
   while (std::getline(stream, buffer)) {
     if (buffer.empty()) { continue; }
@@ -98,7 +775,24 @@ void test_file(std::istream &stream) {
             << "+---------------------------------------" << std::endl
             << std::endl;
 
-        regex = Regex::init(regex_string);
+        bool match_empty = false;
+        auto semantics = MatchSemantics::LONGEST;
+
+        for (size_t i = 1; i < marker.size(); ++i) {
+          switch (marker[i]) {
+            case 'E':
+              match_empty = true;
+              break;
+            case 'F':
+              semantics = MatchSemantics::LEFTMOST_FIRST;
+              break;
+            default:
+              regex_warn("unknown marker");
+              break;
+          }
+        }
+
+        regex = Regex::init(regex_string, semantics);
 
         switch (marker[0]) {
           case 'I':
@@ -117,24 +811,20 @@ void test_file(std::istream &stream) {
             break;
         }
 
-        bool match_empty = false;
-
-        if (marker.size() > 1) {
-          switch (marker[1]) {
-            case 'E':
-              match_empty = true;
-              break;
-            default:
-              regex_warn("unknown marker");
-              break;
-          }
+        if (regex) {
+          loaded = save_and_load(regex.value());
+          if (!loaded) { regex.reset(); }
         }
 
         if (regex) {
+          if (semantics == MatchSemantics::LONGEST) {
+            set_sources.emplace_back(regex_string);
+          }
+
           if (match_empty) {
-            test_match(regex.value(), "", 0, 0);
+            test_match(regex.value(), loaded.value(), "", 0, 0);
           } else {
-            test_match(regex.value(), "", -1, -1);
+            test_match(regex.value(), loaded.value(), "", -1, -1);
           }
         }
       } else {
@@ -163,10 +853,15 @@ void test_file(std::istream &stream) {
 
         std::string input = escape_string(buffer.substr(offset));
 
-        test_match(regex.value(), input, expect_start, expect_size);
+        set_inputs.emplace_back(input);
+        test_match(
+            regex.value(), loaded.value(), input, expect_start, expect_size
+        );
       }
     }
   }
+
+  test_set(set_sources, set_inputs);
 }
 
 int main(int argc, const char **argv) {
@@ -205,4 +900,14 @@ int main(int argc, const char **argv) {
       std::string("no text file found in directory ").append(test_dir)
     );
   }
+
+  test_large_alternation();
+  test_cache();
+  test_scratch();
+  test_handle();
+  test_captures();
+  test_stream();
+  test_task();
+  test_parallel();
+  test_grep(std::filesystem::path{argv[0]}.replace_filename("regex-grep"));
 }
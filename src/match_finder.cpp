@@ -0,0 +1,44 @@
+#include "match_finder.hpp"
+
+
+std::optional<MatchFinder::MatchRange> MatchFinder::next() {
+  if (search_start == NO_START || search_start > input.size()) {
+    return std::nullopt;
+  }
+
+  auto offset = simulation.skip(input, search_start);
+
+  simulation.start(offset);
+
+  while (offset < input.size() && simulation.running()) {
+    // no match attempt is running, the next one starts at a byte which
+    // may begin a match
+    if (simulation.idle()) {
+      auto next_start = simulation.skip(input, offset);
+
+      if (next_start != offset) {
+        offset = next_start;
+        simulation.start(offset);
+        continue;
+      }
+    }
+
+    simulation.step(offset, input[offset]);
+    ++offset;
+  }
+
+  if (simulation.running()) { simulation.finish(offset); }
+
+  auto &best = simulation.best();
+
+  if (!best || anchored) {
+    // an anchored regex only matches at the start of input
+    search_start = NO_START;
+  } else {
+    // an empty match is not found twice at the same offset
+    auto [begin, end] = best.value();
+    search_start = begin == end ? end + 1 : end;
+  }
+
+  return best;
+}
@@ -0,0 +1,28 @@
+#include "match_task.hpp"
+
+#include "regex_stream.hpp"
+
+
+MatchTask MatchTask::start(const Program &program) {
+  RegexStream stream{program};
+
+  while (auto chunk = co_await NextInput{}) {
+    for (auto match : stream.feed(chunk.value())) { co_yield match; }
+  }
+
+  for (auto match : stream.finish()) { co_yield match; }
+}
+
+std::optional<MatchTask::MatchRange> MatchTask::next() {
+  auto &promise = handle.promise();
+
+  if (handle.done()) { return std::nullopt; }
+  if (promise.waiting && !promise.input && !promise.closed) {
+    return std::nullopt;
+  }
+
+  promise.event.reset();
+  handle.resume();
+
+  return std::exchange(promise.event, std::nullopt);
+}
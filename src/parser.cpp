@@ -25,6 +25,10 @@ std::optional<std::string> Parser::build_graph() {
             top_sym == TokenType::LEFT_BRACKETS_NOT
         ) {
           edge = Edge::character_set(token->string);
+        } else if (reverse) {
+          edge = Edge::concanetation(
+              std::string{token->string.rbegin(), token->string.rend()}
+          );
         } else {
           edge = Edge::concanetation(token->string);
         }
@@ -33,8 +37,11 @@ std::optional<std::string> Parser::build_graph() {
 
         break;
       }
-      case TokenType::VERTICAL_BAR:
       case TokenType::LEFT_PARENTHESES:
+        group_stack.emplace_back(++group_size);
+        graph_stack.emplace_back(token->type, std::vector<RegGraph>{});
+        break;
+      case TokenType::VERTICAL_BAR:
       case TokenType::LEFT_BRACKETS_NOT:
       case TokenType::LEFT_BRACKETS:
         graph_stack.emplace_back(token->type, std::vector<RegGraph>{});
@@ -61,6 +68,11 @@ std::optional<std::string> Parser::build_graph() {
       }
       case TokenType::RIGHT_PARENTHESES: {
         auto graph = pop_and_join();
+
+        regex_assert(!group_stack.empty());
+        if (captures) { graph.capture_group(group_stack.back()); }
+        group_stack.pop_back();
+
         graph_stack.back().second.emplace_back(std::move(graph));
 
         break;
@@ -167,37 +179,85 @@ end_braces:
     }
   }
 
+  if (graph_stack.size() == 1) {
+    auto &top_vec = graph_stack.back().second;
+
+    for (size_t i = 0; i < top_vec.size(); ++i) {
+      auto string = top_vec[i].literal_string();
+
+      if (string && string->size() > literal.size()) {
+        literal_index = i;
+        literal = string.value();
+      }
+    }
+
+    // the part is anchored at the split element
+    if (part == ParsePart::BEFORE) {
+      top_vec.erase(top_vec.begin() + part_index, top_vec.end());
+      match_end = true;
+    } else if (part == ParsePart::AFTER) {
+      top_vec.erase(top_vec.begin(), top_vec.begin() + part_index + 1);
+      match_begin = true;
+    }
+  } else {
+    regex_assert(part == ParsePart::WHOLE);
+  }
+
   regex_graph = pop_and_join();
 
+  if (part == ParsePart::WHOLE) {
+    regex_graph.split_index = literal_index;
+    regex_graph.split_string = literal;
+  }
+
   regex_graph.head->marker = NodeMarker::MATCH_BEGIN;
   regex_graph.tail->marker = NodeMarker::MATCH_END;
 
+  // the reversed regex is anchored at the other ends
+  if (reverse) { std::swap(match_begin, match_end); }
+
   if (!match_begin) { regex_graph.match_begin_unknown(); }
   if (!match_end) { regex_graph.match_tail_unknown(); }
 
-  regex_graph.optimize_graph();
-
   if (regex_unlikely(debug)) {
     std::cout << "---------- [  PARSER  ] ----------" << std::endl;
+  }
+
+  // capture tags are recorded by the first path in the order of edges
+  regex_graph.optimize_graph(
+      debug, semantics == MatchSemantics::LEFTMOST_FIRST || captures
+  );
+
+  if (regex_unlikely(debug)) {
     std::cout << regex_graph;
   }
 
   return std::nullopt;
 }
 
+RegGraph Parser::concatenate_top() {
+  auto &top_vec = graph_stack.back().second;
+
+  if (reverse) {
+    return RegGraph::concatenate_graph(top_vec.rbegin(), top_vec.rend());
+  }
+
+  return RegGraph::concatenate_graph(top_vec.begin(), top_vec.end());
+}
+
 RegGraph Parser::pop_and_join() {
   regex_assert(!graph_stack.empty());
-  auto &[_, top_vec] = graph_stack.back();
-  auto con_graph = RegGraph::concatenate_graph(top_vec.begin(), top_vec.end());
+  auto con_graph = concatenate_top();
 
   while (graph_stack.back().first != TokenType::LEFT_PARENTHESES) {
     graph_stack.pop_back();
 
     regex_assert(!graph_stack.empty());
-    auto &top_vec = graph_stack.back().second;
 
-    auto graph = RegGraph::concatenate_graph(top_vec.begin(), top_vec.end());
-    con_graph = RegGraph::join_graph(std::move(con_graph), std::move(graph));
+    // alternatives are popped from the last one, the edge of the first
+    // one must come first to keep their priority
+    auto graph = concatenate_top();
+    con_graph = RegGraph::join_graph(std::move(graph), std::move(con_graph));
   }
 
   graph_stack.pop_back();
@@ -0,0 +1,585 @@
+#include "program.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+template<class T>
+static ProgramSection append_section(
+    std::string &buffer, const T *data, size_t size
+) {
+  ProgramSection section{.offset = buffer.size(), .size = size};
+
+  buffer.append(reinterpret_cast<const char *>(data), sizeof(T) * size);
+  buffer.resize((buffer.size() + 7) / 8 * 8, '\0');
+
+  return section;
+}
+
+Program Program::compile(
+    RegGraph &graph, std::string_view source, MatchSemantics semantics
+) {
+  std::unordered_map<RegGraph::NodePtr, uint32_t> node_map{};
+
+  for (auto ptr = graph.nodes.begin(); ptr != graph.nodes.end(); ++ptr) {
+    node_map.emplace(ptr, node_map.size());
+  }
+
+  std::vector<ProgramNode> nodes{};
+  std::vector<ProgramEdge> edges{};
+  std::vector<CharacterSet> sets{};
+  std::vector<uint32_t> dispatch_offset{};
+  std::vector<uint32_t> dispatch_index{};
+  std::string strings{};
+  uint32_t pattern_size = 1;
+
+  auto set_index = [&sets](const CharacterSet &set) {
+    for (size_t i = 0; i < sets.size(); ++i) {
+      if (sets[i] == set) { return i; }
+    }
+    sets.emplace_back(set);
+    return sets.size() - 1;
+  };
+
+  for (auto ptr = graph.nodes.begin(); ptr != graph.nodes.end(); ++ptr) {
+    ProgramNode node{
+      .marker = static_cast<uint32_t>(ptr->marker),
+      .pattern = ptr->pattern,
+      .edge_begin = static_cast<uint32_t>(edges.size()),
+      .edge_end = 0,
+      .dispatch = NO_DISPATCH,
+      .flags = 0,
+    };
+
+    for (auto &[edge, dest] : ptr->edges) {
+      ProgramEdge item{
+        .type = static_cast<uint32_t>(edge.type),
+        .dest = node_map[dest],
+        .value = 0,
+        .size = 0,
+      };
+
+      switch (edge.type) {
+        case EdgeType::CONCATENATION:
+          item.value = strings.size();
+          item.size = edge.string.size();
+          strings.append(edge.string);
+          break;
+        case EdgeType::CHARACTER_SET:
+          item.value = set_index(edge.set);
+          break;
+        case EdgeType::REPEAT:
+        case EdgeType::EXIT_LOOP:
+          item.value = edge.range.lower_bound;
+          item.size = edge.range.upper_bound;
+          break;
+        case EdgeType::TAG:
+          item.value = edge.tag;
+          break;
+        default:
+          break;
+      }
+
+      edges.emplace_back(item);
+    }
+
+    node.edge_end = edges.size();
+
+    if (ptr->has_dispatch()) {
+      node.dispatch = dispatch_offset.size();
+
+      for (auto offset : ptr->dispatch_offset) {
+        dispatch_offset.emplace_back(dispatch_index.size() + offset);
+      }
+
+      dispatch_index.insert(
+          dispatch_index.end(),
+          ptr->dispatch_index.begin(), ptr->dispatch_index.end()
+      );
+    }
+
+    if (ptr->marker == NodeMarker::MATCH_END) {
+      pattern_size = std::max(pattern_size, ptr->pattern + 1);
+    }
+
+    nodes.emplace_back(node);
+  }
+
+  mark_universal(nodes, edges, sets);
+
+  auto required_chars = find_required_chars(nodes, edges, sets, strings);
+
+  ProgramHeader header{};
+
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.endian_mark = ENDIAN_MARK;
+  header.head = node_map[graph.head];
+  header.tail = node_map[graph.tail];
+  header.pattern_size = pattern_size;
+  header.min_length = graph.min_length;
+  header.max_length = graph.max_length;
+  header.split_index = graph.split_index.value_or(NO_SPLIT);
+  header.flags = semantics == MatchSemantics::LEFTMOST_FIRST ?
+      PROGRAM_LEFTMOST_FIRST : 0;
+
+  std::string buffer(sizeof(ProgramHeader), '\0');
+
+  header.node = append_section(buffer, nodes.data(), nodes.size());
+  header.edge = append_section(buffer, edges.data(), edges.size());
+  header.set = append_section(buffer, sets.data(), sets.size());
+  header.dispatch_offset = append_section(
+      buffer, dispatch_offset.data(), dispatch_offset.size()
+  );
+  header.dispatch_index = append_section(
+      buffer, dispatch_index.data(), dispatch_index.size()
+  );
+  header.string = append_section(buffer, strings.data(), strings.size());
+  header.required_chars = append_section(
+      buffer, required_chars.data(), required_chars.size()
+  );
+  header.split_string = append_section(
+      buffer, graph.split_string.data(), graph.split_string.size()
+  );
+  header.source = append_section(buffer, source.data(), source.size());
+  header.image_size = buffer.size();
+
+  std::memcpy(buffer.data(), &header, sizeof(ProgramHeader));
+
+  // copy into 8 bytes aligned storage
+  auto storage = std::shared_ptr<uint64_t[]>{
+      new uint64_t[buffer.size() / 8]
+  };
+  std::memcpy(storage.get(), buffer.data(), buffer.size());
+
+  auto program = view(storage, storage.get(), buffer.size());
+  regex_assert(program.has_value());
+
+  return std::move(program.value());
+}
+
+std::optional<Program> Program::view(
+    std::shared_ptr<const void> storage, const void *image, size_t size
+) {
+  if (
+      reinterpret_cast<uintptr_t>(image) % 8 != 0 ||
+      size < sizeof(ProgramHeader)
+  ) {
+    return std::nullopt;
+  }
+
+  auto header = reinterpret_cast<const ProgramHeader *>(image);
+
+  if (
+      std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header->version != VERSION ||
+      header->endian_mark != ENDIAN_MARK ||
+      header->image_size > size ||
+      header->image_size % 8 != 0 ||
+      header->pattern_size == 0 ||
+      header->min_length > header->max_length ||
+      (header->split_index == NO_SPLIT) != (header->split_string.size == 0) ||
+      (header->flags & ~PROGRAM_LEFTMOST_FIRST) != 0
+  ) {
+    return std::nullopt;
+  }
+
+  auto check_section = [header](const ProgramSection &section, size_t elem) {
+    return
+        section.offset % 8 == 0 &&
+        section.offset >= sizeof(ProgramHeader) &&
+        section.offset <= header->image_size &&
+        section.size <= (header->image_size - section.offset) / elem;
+  };
+
+  if (
+      !check_section(header->node, sizeof(ProgramNode)) ||
+      !check_section(header->edge, sizeof(ProgramEdge)) ||
+      !check_section(header->set, sizeof(CharacterSet)) ||
+      !check_section(header->dispatch_offset, sizeof(uint32_t)) ||
+      !check_section(header->dispatch_index, sizeof(uint32_t)) ||
+      !check_section(header->string, sizeof(char)) ||
+      !check_section(header->required_chars, sizeof(char)) ||
+      !check_section(header->split_string, sizeof(char)) ||
+      !check_section(header->source, sizeof(char))
+  ) {
+    return std::nullopt;
+  }
+
+  Program program{};
+
+  program.storage = std::move(storage);
+  program.header = header;
+  program.nodes = program.section<ProgramNode>(header->node);
+  program.edges = program.section<ProgramEdge>(header->edge);
+  program.sets = program.section<CharacterSet>(header->set);
+  program.dispatch_offset =
+      program.section<uint32_t>(header->dispatch_offset);
+  program.dispatch_index = program.section<uint32_t>(header->dispatch_index);
+  program.strings = program.section<char>(header->string);
+
+  if (!program.validate()) { return std::nullopt; }
+
+  static std::atomic<uint64_t> next_id{1};
+  program.id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+  return program;
+}
+
+void Program::mark_universal(
+    std::vector<ProgramNode> &nodes, const std::vector<ProgramEdge> &edges,
+    const std::vector<CharacterSet> &sets
+) {
+  // greatest fixpoint: a node stays universal while it has an empty edge or
+  // an edge accepting every character to a universal node
+  for (auto &node : nodes) { node.flags |= NODE_UNIVERSAL; }
+
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for (auto &node : nodes) {
+      if ((node.flags & NODE_UNIVERSAL) == 0) { continue; }
+
+      bool universal = false;
+
+      for (auto index = node.edge_begin; index < node.edge_end; ++index) {
+        auto &edge = edges[index];
+
+        if ((nodes[edge.dest].flags & NODE_UNIVERSAL) == 0) { continue; }
+
+        if (
+            edge_type(edge) == EdgeType::EMPTY ||
+            edge_type(edge) == EdgeType::TAG ||
+            (
+              edge_type(edge) == EdgeType::CHARACTER_SET &&
+              sets[edge.value] == CharacterSet{CHARACTER_SET_ALL}
+            )
+        ) {
+          universal = true;
+          break;
+        }
+      }
+
+      if (!universal) {
+        node.flags &= ~NODE_UNIVERSAL;
+        changed = true;
+      }
+    }
+  }
+}
+
+std::string Program::find_required_chars(
+    const std::vector<ProgramNode> &nodes,
+    const std::vector<ProgramEdge> &edges,
+    const std::vector<CharacterSet> &sets, std::string_view strings
+) {
+  auto edge_string = [strings](const ProgramEdge &edge) {
+    return strings.substr(edge.value, edge.size);
+  };
+
+  CharacterSet consumed{};
+
+  for (auto &edge : edges) {
+    if (edge_type(edge) == EdgeType::CHARACTER_SET) {
+      consumed |= sets[edge.value];
+    } else if (edge_type(edge) == EdgeType::CONCATENATION) {
+      for (char c : edge_string(edge)) { consumed.set_char(c); }
+    }
+  }
+
+  // a character is required if no match end is reachable from a match
+  // begin without an edge which must consume it
+  auto avoidable = [&](uint32_t c) {
+    CharacterSet only{};
+    only.set_char(c);
+
+    std::vector<bool> visited(nodes.size(), false);
+    std::vector<uint32_t> stack{};
+
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+      if (nodes[i].marker == static_cast<uint32_t>(NodeMarker::MATCH_BEGIN)) {
+        visited[i] = true;
+        stack.push_back(i);
+      }
+    }
+
+    while (!stack.empty()) {
+      auto index = stack.back();
+      stack.pop_back();
+
+      auto &node = nodes[index];
+
+      if (node.marker == static_cast<uint32_t>(NodeMarker::MATCH_END)) {
+        return true;
+      }
+
+      for (auto i = node.edge_begin; i < node.edge_end; ++i) {
+        auto &edge = edges[i];
+
+        if (
+            (
+              edge_type(edge) == EdgeType::CHARACTER_SET &&
+              sets[edge.value] == only
+            ) ||
+            (
+              edge_type(edge) == EdgeType::CONCATENATION &&
+              edge_string(edge).find(static_cast<char>(c)) !=
+                  std::string_view::npos
+            ) ||
+            visited[edge.dest]
+        ) {
+          continue;
+        }
+
+        visited[edge.dest] = true;
+        stack.push_back(edge.dest);
+      }
+    }
+
+    return false;
+  };
+
+  std::string result{};
+
+  for (uint32_t c = 0; c < 128; ++c) {
+    if (consumed.has_char(c) && !avoidable(c)) {
+      result.push_back(static_cast<char>(c));
+    }
+  }
+
+  return result;
+}
+
+std::optional<std::string_view> Program::literal() const {
+  std::optional<std::string_view> result{};
+
+  for (uint32_t i = 0; i < node_size(); ++i) {
+    if (marker(i) != NodeMarker::MATCH_BEGIN) { continue; }
+
+    // one match begin, its only edge takes the string to the match end,
+    // nothing after the match end can change the match
+    auto &node = nodes[i];
+    if (result || node.edge_end - node.edge_begin != 1) { return std::nullopt; }
+
+    auto &edge = edges[node.edge_begin];
+    if (
+        edge_type(edge) != EdgeType::CONCATENATION || edge.size == 0 ||
+        marker(edge.dest) != NodeMarker::MATCH_END
+    ) {
+      return std::nullopt;
+    }
+
+    auto &end = nodes[edge.dest];
+    if (end.edge_begin != end.edge_end && !is_universal(edge.dest)) {
+      return std::nullopt;
+    }
+
+    result = string(edge);
+  }
+
+  return result;
+}
+
+bool Program::validate() const {
+  if (header->head >= node_size() || header->tail >= node_size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < node_size(); ++i) {
+    auto &node = nodes[i];
+
+    if (
+        node.marker > static_cast<uint32_t>(NodeMarker::MATCH_END) ||
+        node.pattern >= header->pattern_size ||
+        node.edge_begin > node.edge_end ||
+        node.edge_end > edge_size()
+    ) {
+      return false;
+    }
+
+    if (node.dispatch != NO_DISPATCH) {
+      if (
+          header->dispatch_offset.size < ::Node::DISPATCH_SLOT_SIZE + 1 ||
+          node.dispatch >
+              header->dispatch_offset.size - ::Node::DISPATCH_SLOT_SIZE - 1
+      ) {
+        return false;
+      }
+
+      for (size_t slot = 0; slot < ::Node::DISPATCH_SLOT_SIZE; ++slot) {
+        auto begin = dispatch_offset[node.dispatch + slot];
+        auto end = dispatch_offset[node.dispatch + slot + 1];
+
+        if (begin > end || end > header->dispatch_index.size) {
+          return false;
+        }
+
+        for (auto index = begin; index < end; ++index) {
+          if (dispatch_index[index] >= node.edge_end - node.edge_begin) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < edge_size(); ++i) {
+    auto &edge = edges[i];
+
+    if (edge.dest >= node_size()) { return false; }
+
+    switch (edge_type(edge)) {
+      case EdgeType::EMPTY:
+      case EdgeType::ENTER_LOOP:
+      case EdgeType::TAG:
+        break;
+      case EdgeType::REPEAT:
+      case EdgeType::EXIT_LOOP:
+        if (
+            edge.value > RepeatRange::BOUND_LIMIT ||
+            edge.size > RepeatRange::BOUND_LIMIT ||
+            (edge.size != 0 && edge.value >= edge.size)
+        ) {
+          return false;
+        }
+        break;
+      case EdgeType::CONCATENATION:
+        if (
+            edge.size == 0 ||
+            edge.value > header->string.size ||
+            edge.size > header->string.size - edge.value
+        ) {
+          return false;
+        }
+        break;
+      case EdgeType::CHARACTER_SET:
+        if (edge.value >= header->set.size) { return false; }
+        break;
+      default:
+        return false;
+    }
+  }
+
+  // every node lies inside the same number of loops on all paths from the
+  // head, so REPEAT and EXIT_LOOP always find the frame of their loop, and
+  // no cycle enters loops without leaving them
+  constexpr uint32_t NO_DEPTH = UINT32_MAX;
+
+  std::vector<uint32_t> depth(node_size(), NO_DEPTH);
+  std::vector<uint32_t> stack{header->head};
+
+  depth[header->head] = 0;
+
+  while (!stack.empty()) {
+    auto index = stack.back();
+    stack.pop_back();
+
+    auto &node = nodes[index];
+
+    for (auto i = node.edge_begin; i < node.edge_end; ++i) {
+      auto &edge = edges[i];
+      auto dest_depth = depth[index];
+
+      if (edge_type(edge) == EdgeType::ENTER_LOOP) {
+        ++dest_depth;
+      } else if (edge_type(edge) == EdgeType::EXIT_LOOP) {
+        if (dest_depth == 0) { return false; }
+        --dest_depth;
+      } else if (edge_type(edge) == EdgeType::REPEAT) {
+        if (dest_depth == 0) { return false; }
+      }
+
+      if (depth[edge.dest] == NO_DEPTH) {
+        depth[edge.dest] = dest_depth;
+        stack.push_back(edge.dest);
+      } else if (depth[edge.dest] != dest_depth) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void Program::print_edge(std::ostream &stream, const ProgramEdge &edge) const {
+  switch (edge_type(edge)) {
+    case EdgeType::EMPTY:
+      stream << "EMPTY";
+      break;
+    case EdgeType::CONCATENATION:
+      stream << "CONCATENATION: " << make_escape(std::string{string(edge)});
+      break;
+    case EdgeType::CHARACTER_SET:
+      stream << "CHARACTER_SET: " << set(edge);
+      break;
+    case EdgeType::REPEAT:
+      stream << "REPEAT: " << range(edge);
+      break;
+    case EdgeType::ENTER_LOOP:
+      stream << "ENTER_LOOP";
+      break;
+    case EdgeType::EXIT_LOOP:
+      stream << "EXIT_LOOP: " << range(edge);
+      break;
+    case EdgeType::TAG:
+      stream << "TAG: " << edge.value;
+      break;
+    default:
+      stream << "UNKNOWN";
+      break;
+  }
+}
+
+std::ostream &operator<<(std::ostream &stream, const Program &other) {
+  stream
+      << "[PROGRAM] size: " << other.node_size() << ' ' << other.edge_size()
+      << ", head: " << other.head()
+      << ", tail: " << other.tail()
+      << ", image: " << other.header->image_size
+      << ", length: " << other.min_length() << ' ';
+  if (other.max_length() == RegGraph::UNBOUNDED_LENGTH) {
+    stream << "inf";
+  } else {
+    stream << other.max_length();
+  }
+  if (other.semantics() == MatchSemantics::LEFTMOST_FIRST) {
+    stream << ", LEFTMOST_FIRST";
+  }
+  stream << '\n';
+
+  for (uint32_t i = 0; i < other.node_size(); ++i) {
+    auto &node = other.node(i);
+
+    stream << "NODE: " << i;
+    switch (other.marker(i)) {
+      case NodeMarker::MATCH_BEGIN:
+        stream << ", MATCH_BEGIN";
+        break;
+      case NodeMarker::MATCH_END:
+        stream << ", MATCH_END";
+        if (node.pattern != 0) { stream << ' ' << node.pattern; }
+        break;
+      default:
+        break;
+    }
+    if (node.dispatch != Program::NO_DISPATCH) { stream << ", DISPATCH"; }
+    if (other.is_universal(i)) { stream << ", UNIVERSAL"; }
+    stream << '\n';
+
+    for (auto index = node.edge_begin; index < node.edge_end; ++index) {
+      auto &edge = other.edge(index);
+
+      stream << "    |=> " << edge.dest << ",\t";
+      other.print_edge(stream, edge);
+      stream << '\n';
+    }
+  }
+
+  return stream;
+}
@@ -1,6 +1,9 @@
 #include "reg_graph.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <map>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -28,7 +31,21 @@ bool RegGraph::is_simple_character_set_graph() {
   return is_simple_graph() && get_first_edge().first.is_character_set();
 }
 
+static size_t add_length(size_t length1, size_t length2) {
+  return length1 > RegGraph::UNBOUNDED_LENGTH - length2 ?
+      RegGraph::UNBOUNDED_LENGTH : length1 + length2;
+}
+
+static size_t multiply_length(size_t length, size_t count) {
+  if (length == 0 || count == 0) { return 0; }
+  return length > RegGraph::UNBOUNDED_LENGTH / count ?
+      RegGraph::UNBOUNDED_LENGTH : length * count;
+}
+
 void RegGraph::concatenat_graph_continue(RegGraph &&graph) {
+  auto new_min_length = add_length(min_length, graph.min_length);
+  auto new_max_length = add_length(max_length, graph.max_length);
+
   if (graph.is_simple_empty_graph()) {
     return;
   } else if (is_simple_empty_graph()) {
@@ -45,6 +62,9 @@ void RegGraph::concatenat_graph_continue(RegGraph &&graph) {
     tail = graph.tail;
     graph.give_up_nodes(*this);
   }
+
+  min_length = new_min_length;
+  max_length = new_max_length;
 }
 
 void RegGraph::join_character_set_graph_continue(RegGraph &&graph) {
@@ -74,6 +94,9 @@ RegGraph RegGraph::clone() {
     }
   }
 
+  new_graph.min_length = min_length;
+  new_graph.max_length = max_length;
+
   return new_graph;
 }
 
@@ -88,10 +111,16 @@ void RegGraph::repeat_graph(RepeatRange range) {
   // {0,1} does not introduce loop
   if (range.lower_bound == 0 && range.upper_bound == 2) {
     head->add_empty_edge(tail);
+    min_length = 0;
     return;
   }
   // loop needs to be created
 
+  auto new_min_length = multiply_length(min_length, range.lower_bound);
+  auto new_max_length = range.upper_bound == 0 ?
+      multiply_length(max_length, UNBOUNDED_LENGTH) :
+      multiply_length(max_length, range.upper_bound - 1);
+
   if (range.lower_bound < 2 && range.upper_bound == 0) {
     // unbounded loop, empty edge could do it
     auto new_head = create_node();
@@ -178,6 +207,9 @@ void RegGraph::repeat_graph(RepeatRange range) {
       head->add_empty_edge(tail);
     }
   }
+
+  min_length = new_min_length;
+  max_length = new_max_length;
 }
 
 void RegGraph::garbage_collection(PassFn pass_fn) {
@@ -251,6 +283,38 @@ bool RegGraph::replace_empty_transition(NodeSet &new_nodes) {
   return true;
 }
 
+std::vector<std::pair<Edge, RegGraph::NodePtr>>
+RegGraph::expand_empty_edge(NodePtr node) {
+  std::vector<std::pair<Edge, NodePtr>> result{};
+  // an empty path reaching a node again is tried after the first one and
+  // cannot add anything
+  std::unordered_set<NodePtr> visited{node};
+  std::vector<std::pair<NodePtr, size_t>> stack{{node, 0}};
+
+  while (!stack.empty()) {
+    auto &[curr, index] = stack.back();
+
+    if ((curr == tail && curr != node) || index == curr->edges.size()) {
+      stack.pop_back();
+      continue;
+    }
+
+    auto &[edge, dest] = curr->edges[index++];
+
+    if (!edge.is_empty()) {
+      result.emplace_back(edge, dest);
+    } else if (curr != tail && visited.emplace(dest).second) {
+      if (dest == tail || dest->marker != NodeMarker::ANONYMOUS) {
+        result.emplace_back(Edge::empty(), dest);
+      } else {
+        stack.emplace_back(dest, 0);
+      }
+    }
+  }
+
+  return result;
+}
+
 bool RegGraph::fold_empty_edge(NodeSet &new_nodes) {
   std::vector<std::pair<NodePtr, size_t>> stack{{head, 0}};
   new_nodes.emplace(head);
@@ -258,7 +322,11 @@ bool RegGraph::fold_empty_edge(NodeSet &new_nodes) {
   while(!stack.empty()) {
     auto [fold_node, fold_index] = stack.back();
 
-    if (fold_index == 0) {
+    if (fold_index == 0 && ordered) {
+      // the node was first met, the folded edges must keep their priority
+      fold_node->edges = expand_empty_edge(fold_node);
+      fold_node->unique_edge_in_order();
+    } else if (fold_index == 0) {
       // the node was first met, collect nodes reachable through empty edge
       std::unordered_set<NodePtr> reachable{};
       size_t start_depth = stack.size();
@@ -330,19 +398,280 @@ bool RegGraph::fold_empty_edge(NodeSet &new_nodes) {
   return true;
 }
 
+// edges equal by operator== have the same hash
+struct EdgeHash {
+  size_t operator()(const Edge &edge) const {
+    size_t value = 0;
+
+    switch (edge.type) {
+      case EdgeType::CONCATENATION:
+        value = std::hash<std::string>{}(edge.string);
+        break;
+      case EdgeType::CHARACTER_SET:
+        value = std::hash<std::string_view>{}(std::string_view{
+            reinterpret_cast<const char *>(edge.set.set.data()),
+            edge.set.set.size()
+        });
+        break;
+      case EdgeType::REPEAT:
+      case EdgeType::EXIT_LOOP:
+        value = edge.range.lower_bound * 31 + edge.range.upper_bound;
+        break;
+      case EdgeType::TAG:
+        value = edge.tag;
+        break;
+      default:
+        break;
+    }
+
+    return value * 8 + static_cast<size_t>(edge.type);
+  }
+};
+
+RegGraph::BlockMap RegGraph::bisimulation_partition(bool backward) {
+  std::vector<NodePtr> node_list{};
+  std::unordered_map<NodePtr, size_t> node_index{};
+
+  for (auto ptr = nodes.begin(); ptr != nodes.end(); ++ptr) {
+    node_index.emplace(ptr, node_list.size());
+    node_list.emplace_back(ptr);
+  }
+
+  // edges are compared by value, every distinct edge gets a label index
+  std::unordered_map<Edge, size_t, EdgeHash> labels{};
+
+  // the nodes reaching every node through an edge with each label, a node
+  // reaches its successors forward and its predecessors backward
+  std::vector<std::vector<std::pair<size_t, size_t>>> reached_by(
+      node_list.size()
+  );
+
+  for (size_t i = 0; i < node_list.size(); ++i) {
+    for (auto &[edge, dest] : node_list[i]->edges) {
+      auto label = labels.emplace(edge, labels.size()).first->second;
+      auto next = node_index[dest];
+
+      if (backward) {
+        reached_by[i].emplace_back(label, next);
+      } else {
+        reached_by[next].emplace_back(label, i);
+      }
+    }
+  }
+
+  // head, tail and marked nodes can never be merged with other nodes
+  std::map<std::tuple<NodeMarker, uint32_t, bool, bool>, size_t> initial{};
+  std::vector<size_t> block_of(node_list.size());
+  std::vector<std::vector<size_t>> members{};
+  // the index of every node in the members of its block
+  std::vector<size_t> position(node_list.size());
+
+  for (size_t i = 0; i < node_list.size(); ++i) {
+    auto ptr = node_list[i];
+    auto key = std::make_tuple(
+        ptr->marker, ptr->pattern, ptr == head, ptr == tail
+    );
+    auto block = initial.emplace(key, initial.size()).first->second;
+
+    if (block == members.size()) { members.emplace_back(); }
+
+    block_of[i] = block;
+    position[i] = members[block].size();
+    members[block].emplace_back(i);
+  }
+
+  // every block is a splitter: the nodes of a block reaching it through a
+  // label are split from the ones which do not. Both parts of a split
+  // block are splitters again, a node may reach both of them through the
+  // same label so one part alone would not tell the nodes apart
+  std::vector<size_t> worklist{};
+  std::vector<bool> pending(members.size(), true);
+
+  for (size_t i = 0; i < members.size(); ++i) { worklist.emplace_back(i); }
+
+  static constexpr size_t NO_SPLIT = SIZE_MAX;
+
+  std::vector<std::pair<size_t, size_t>> reaching{};
+  std::vector<size_t> marked_size{};
+  // the block the marked nodes of a block move to
+  std::vector<size_t> split_of{};
+  std::vector<size_t> touched{};
+
+  while (!worklist.empty()) {
+    auto splitter = worklist.back();
+    worklist.pop_back();
+    pending[splitter] = false;
+
+    reaching.clear();
+    for (auto index : members[splitter]) {
+      reaching.insert(
+          reaching.end(), reached_by[index].begin(), reached_by[index].end()
+      );
+    }
+
+    std::sort(reaching.begin(), reaching.end());
+    reaching.erase(
+        std::unique(reaching.begin(), reaching.end()), reaching.end()
+    );
+
+    for (size_t begin = 0, end = 0; begin < reaching.size(); begin = end) {
+      // the nodes reaching the splitter through one label
+      end = begin;
+      while (
+          end < reaching.size() && reaching[end].first == reaching[begin].first
+      ) {
+        ++end;
+      }
+
+      marked_size.resize(members.size(), 0);
+      touched.clear();
+
+      for (auto i = begin; i < end; ++i) {
+        auto block = block_of[reaching[i].second];
+        if (marked_size[block]++ == 0) { touched.emplace_back(block); }
+      }
+
+      split_of.resize(members.size(), NO_SPLIT);
+
+      for (auto block : touched) {
+        if (marked_size[block] != members[block].size()) {
+          split_of[block] = members.size();
+          members.emplace_back();
+          pending.emplace_back(true);
+          worklist.emplace_back(split_of[block]);
+
+          if (!pending[block]) {
+            pending[block] = true;
+            worklist.emplace_back(block);
+          }
+        }
+
+        marked_size[block] = 0;
+      }
+
+      for (auto i = begin; i < end; ++i) {
+        auto index = reaching[i].second;
+        auto block = block_of[index];
+        auto split = split_of[block];
+
+        if (split == NO_SPLIT) { continue; }
+
+        auto &old_members = members[block];
+        auto last = old_members.back();
+        old_members[position[index]] = last;
+        position[last] = position[index];
+        old_members.pop_back();
+
+        block_of[index] = split;
+        position[index] = members[split].size();
+        members[split].emplace_back(index);
+      }
+
+      for (auto block : touched) { split_of[block] = NO_SPLIT; }
+    }
+  }
+
+  BlockMap block{};
+
+  for (size_t i = 0; i < node_list.size(); ++i) {
+    block.emplace(node_list[i], block_of[i]);
+  }
+
+  return block;
+}
+
+bool RegGraph::merge_bisimilar_node(NodeSet &new_nodes, bool backward) {
+  auto block = bisimulation_partition(backward);
+
+  std::unordered_map<size_t, NodePtr> represent{};
+
+  for (auto ptr = nodes.begin(); ptr != nodes.end(); ++ptr) {
+    represent.emplace(block[ptr], ptr);
+  }
+
+  if (represent.size() == size) { return false; }
+
+  for (auto ptr = nodes.begin(); ptr != nodes.end(); ++ptr) {
+    auto node = represent[block[ptr]];
+
+    for (auto &[_, dest] : ptr->edges) { dest = represent[block[dest]]; }
+
+    // forward bisimilar nodes already share their edges, backward bisimilar
+    // nodes share only their predecessors
+    if (node != ptr && backward) {
+      for (auto &[edge, dest] : ptr->edges) {
+        node->add_edge(Edge{edge}, dest);
+      }
+    }
+  }
+
+  for (auto &[_, node] : represent) {
+    node->unique_edge();
+    new_nodes.emplace(node);
+  }
+
+  head = represent[block[head]];
+  tail = represent[block[tail]];
+
+  return true;
+}
+
+bool RegGraph::merge_forward_bisimilar_node(NodeSet &new_nodes) {
+  return merge_bisimilar_node(new_nodes, false);
+}
+
+bool RegGraph::merge_backward_bisimilar_node(NodeSet &new_nodes) {
+  return merge_bisimilar_node(new_nodes, true);
+}
+
 RegGraph RegGraph::single_edge(Edge &&edge) {
   RegGraph graph{};
+
+  if (edge.is_concatenation()) {
+    graph.min_length = graph.max_length = edge.string.size();
+  } else if (edge.is_character_set()) {
+    graph.min_length = graph.max_length = 1;
+  }
+
   graph.head->add_edge(std::move(edge), graph.tail);
   return graph;
 }
 
 RegGraph RegGraph::join_graph(RegGraph &&graph1, RegGraph &&graph2) {
+  graph1.min_length = std::min(graph1.min_length, graph2.min_length);
+  graph1.max_length = std::max(graph1.max_length, graph2.max_length);
+
   graph1.head->add_empty_edge(graph2.head);
   graph2.tail->add_empty_edge(graph1.tail);
   graph2.give_up_nodes(graph1);
   return std::move(graph1);
 }
 
+RegGraph RegGraph::union_graph(std::vector<RegGraph> &&graphs) {
+  RegGraph graph{};
+
+  for (auto &other : graphs) {
+    if (&other == &graphs.front()) {
+      graph.min_length = other.min_length;
+      graph.max_length = other.max_length;
+    } else {
+      graph.min_length = std::min(graph.min_length, other.min_length);
+      graph.max_length = std::max(graph.max_length, other.max_length);
+    }
+
+    graph.head->add_empty_edge(other.head);
+    other.give_up_nodes(graph);
+  }
+
+  return graph;
+}
+
+void RegGraph::set_pattern(uint32_t pattern) {
+  for (auto &node : nodes) {
+    if (node.marker == NodeMarker::MATCH_END) { node.pattern = pattern; }
+  }
+}
+
 void RegGraph::character_set_complement() {
   if (!is_simple_character_set_graph()) { exit(1); }
   get_first_edge().first.set.complement();
@@ -366,10 +695,68 @@ void RegGraph::match_tail_unknown() {
   tail = node;
 }
 
-void RegGraph::optimize_graph() {
+void RegGraph::capture_group(uint32_t group) {
+  auto new_head = create_node();
+  auto new_tail = create_node();
+
+  new_head->add_edge(Edge::capture_tag(group * 2), head);
+  tail->add_edge(Edge::capture_tag(group * 2 + 1), new_tail);
+
+  head = new_head;
+  tail = new_tail;
+}
+
+std::optional<std::string_view> RegGraph::literal_string() {
+  if (!is_simple_concatenation_graph()) { return std::nullopt; }
+  return get_first_edge().first.string;
+}
+
+void RegGraph::build_dispatch_table() {
+  for (auto &node : nodes) {
+    if (node.edges.size() >= DISPATCH_EDGE_LIMIT) {
+      node.build_dispatch();
+    } else {
+      node.dispatch_offset.clear();
+      node.dispatch_index.clear();
+    }
+  }
+}
+
+size_t RegGraph::edge_size() {
+  size_t result = 0;
+  for (auto &node : nodes) { result += node.edges.size(); }
+  return result;
+}
+
+void RegGraph::optimize_graph(bool debug, bool ordered) {
+  this->ordered = ordered;
+
   edge_deduplication();
   garbage_collection(&RegGraph::replace_empty_transition);
   garbage_collection(&RegGraph::fold_empty_edge);
+
+  size_t origin_size = size;
+  size_t origin_edge_size = edge_size();
+
+  // merging nodes joins their edges whatever their priority, so only
+  // graphs without priority are merged
+  while (!ordered) {
+    size_t last_size = size;
+
+    garbage_collection(&RegGraph::merge_forward_bisimilar_node);
+    garbage_collection(&RegGraph::merge_backward_bisimilar_node);
+
+    if (size == last_size) { break; }
+  }
+
+  build_dispatch_table();
+
+  if (regex_unlikely(debug)) {
+    std::cout
+        << "[REDUCE] states: " << origin_size << " -> " << size
+        << ", edges: " << origin_edge_size << " -> " << edge_size()
+        << std::endl;
+  }
 }
 
 std::ostream &operator<<(std::ostream &stream, RegGraph &other) {
@@ -393,6 +780,7 @@ std::ostream &operator<<(std::ostream &stream, RegGraph &other) {
         break;
       case NodeMarker::MATCH_END:
         stream << ", MATCH_END";
+        if (ptr->pattern != 0) { stream << ' ' << ptr->pattern; }
         break;
       default:
         break;
@@ -425,6 +813,52 @@ void Node::unique_edge() {
   edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
 }
 
+void Node::unique_edge_in_order() {
+  std::vector<std::pair<Edge, RegGraph::NodePtr>> result{};
+
+  for (auto &item : edges) {
+    if (std::find(result.begin(), result.end(), item) == result.end()) {
+      result.emplace_back(std::move(item));
+    }
+  }
+
+  edges = std::move(result);
+}
+
+void Node::build_dispatch() {
+  dispatch_offset.clear();
+  dispatch_index.clear();
+
+  for (size_t slot = 0; slot < DISPATCH_SLOT_SIZE; ++slot) {
+    dispatch_offset.emplace_back(dispatch_index.size());
+
+    for (size_t i = 0; i < edges.size(); ++i) {
+      auto &edge = edges[i].first;
+
+      switch (edge.type) {
+        case EdgeType::CONCATENATION:
+          // a string starting out of ascii goes to the last slot with the
+          // other bytes out of ascii, an empty one consumes no input
+          if (edge.string.empty() || dispatch_slot(edge.string[0]) == slot) {
+            dispatch_index.emplace_back(i);
+          }
+          break;
+        case EdgeType::CHARACTER_SET:
+          if (slot + 1 < DISPATCH_SLOT_SIZE && edge.set.has_char(slot)) {
+            dispatch_index.emplace_back(i);
+          }
+          break;
+        default:
+          // edges consuming no input are taken on every slot
+          dispatch_index.emplace_back(i);
+          break;
+      }
+    }
+  }
+
+  dispatch_offset.emplace_back(dispatch_index.size());
+}
+
 std::ostream &operator<<(std::ostream &stream, const Edge &other) {
   switch (other.type) {
     case EdgeType::EMPTY:
@@ -439,6 +873,8 @@ std::ostream &operator<<(std::ostream &stream, const Edge &other) {
       return stream << "ENTER_LOOP";
     case EdgeType::EXIT_LOOP:
       return stream << "EXIT_LOOP: " << other.range;
+    case EdgeType::TAG:
+      return stream << "TAG: " << other.tag;
     default:
       return stream << "UNKNOWN";
   }
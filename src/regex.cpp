@@ -1,33 +1,709 @@
 #include "regex.hpp"
 
+#include <cstring>
 #include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "tokenizer.hpp"
 #include "parser.hpp"
 #include "automata.hpp"
+#include "simulation.hpp"
 
 
 bool check_ascii(std::string_view regex) {
-  for (int c : regex) { if (c >= 128 || c < 0) { return false; } }
-  return true;
+  // no early exit, the loop is vectorized and reads the whole input at
+  // many bytes per instruction
+  unsigned char bits = 0;
+  for (unsigned char c : regex) { bits |= c; }
+  return bits < 128;
+}
+
+// the policy finding the same match as Automata::accept
+static MatchPolicy match_policy(const Program &program) {
+  return program.semantics() == MatchSemantics::LEFTMOST_FIRST ?
+      MatchPolicy::LEFTMOST_FIRST : MatchPolicy::LONGEST;
 }
 
-std::optional<Regex> Regex::init(std::string_view regex) {
+std::optional<Regex> Regex::init(
+    std::string_view regex, MatchSemantics semantics
+) {
   if (!check_ascii(regex)) { regex_warn("regex string includes none ascii"); }
 
   RegexTokenizer tokenizer{regex};
-  Parser parser{tokenizer};
+  Parser parser{tokenizer, semantics};
 
   if (auto error = parser.build_graph()) {
     regex_warn(error->c_str());
     return std::nullopt;
   } else {
-    return Regex{std::move(parser.regex_graph)};
+    return Regex{Program::compile(parser.regex_graph, regex, semantics)};
+  }
+}
+
+struct MappedFile {
+  void *address;
+  size_t size;
+
+  ~MappedFile() {
+    if (address != MAP_FAILED) { munmap(address, size); }
+  }
+};
+
+std::optional<std::vector<Regex>> Regex::load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    regex_warn("cannot open " + path);
+    return std::nullopt;
+  }
+
+  struct stat status{};
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    regex_warn("cannot stat " + path);
+    return std::nullopt;
+  }
+
+  std::vector<Regex> result{};
+  size_t size = status.st_size;
+
+  if (size == 0) {
+    close(fd);
+    return result;
+  }
+
+  auto file = std::make_shared<MappedFile>(
+      mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0), size
+  );
+  close(fd);
+
+  if (file->address == MAP_FAILED) {
+    regex_warn("cannot map " + path);
+    return std::nullopt;
+  }
+
+  auto image = static_cast<const char *>(file->address);
+  size_t offset = 0;
+
+  while (offset < size) {
+    auto program = Program::view(file, image + offset, size - offset);
+
+    if (!program) {
+      regex_warn("invalid regex image in " + path);
+      return std::nullopt;
+    }
+
+    offset += program->image().size();
+    result.emplace_back(Regex{std::move(program.value())});
+  }
+
+  return result;
+}
+
+bool Regex::save(std::ostream &stream) const {
+  auto image = program.image();
+  stream.write(image.data(), image.size());
+  return stream.good();
+}
+
+std::ostream &operator<<(std::ostream &stream, const MatchPlan &other) {
+  static const char *const ENGINE_NAMES[] = {
+    "LITERAL", "REVERSE", "SPLIT", "BACKTRACK", "SIMULATION"
+  };
+
+  return stream
+      << "engine: " << ENGINE_NAMES[static_cast<size_t>(other.engine)]
+      << ", window: " << other.window
+      << ", required chars: " << other.required_chars
+      << ", backtrack limit: " << other.backtrack_limit;
+}
+
+MatchPlan Regex::make_plan() const {
+  MatchPlan result{};
+
+  for (
+      auto engine :
+      {MatchEngine::LITERAL, MatchEngine::REVERSE, MatchEngine::SPLIT}
+  ) {
+    if (supports(engine)) {
+      result.engine = engine;
+      break;
+    }
+  }
+
+  return result;
+}
+
+const MatchPlan &Regex::plan() const {
+  std::call_once(match_plan->once, [this]() {
+    match_plan->plan = make_plan();
+  });
+
+  return match_plan->plan;
+}
+
+bool Regex::supports(MatchEngine engine) const {
+  switch (engine) {
+    case MatchEngine::LITERAL:
+      return literal.has_value();
+    case MatchEngine::REVERSE:
+      return program.is_end_anchored() && !program.is_anchored();
+    case MatchEngine::SPLIT:
+      return
+          semantics() == MatchSemantics::LONGEST &&
+          program.split_index().has_value();
+    default:
+      return true;
+  }
+}
+
+std::optional<Regex> Regex::with_plan(const MatchPlan &plan) const {
+  if (!supports(plan.engine)) {
+    regex_warn("the engine of the plan cannot match the regex");
+    return std::nullopt;
+  }
+
+  Regex result{*this};
+
+  result.match_plan = std::make_shared<LazyPlan>();
+  std::call_once(result.match_plan->once, [&result, &plan]() {
+    result.match_plan->plan = plan;
+  });
+
+  return result;
+}
+
+std::optional<size_t> Regex::match_window(std::string_view &input) const {
+  if (input.size() < program.min_length()) { return std::nullopt; }
+
+  auto max_length = program.max_length();
+  if (max_length >= input.size()) { return 0; }
+
+  if (program.is_anchored()) {
+    if (program.is_end_anchored()) { return std::nullopt; }
+
+    // a match starts at the start of input, the rest is never read
+    input = input.substr(0, max_length);
+    return 0;
+  }
+
+  if (program.is_end_anchored()) {
+    // a match ends at the end of input, no match starts before the window
+    auto offset = input.size() - max_length;
+    input.remove_prefix(offset);
+    return offset;
+  }
+
+  return 0;
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match(std::string_view input) const {
+  thread_local MatchScratch scratch{};
+  return match(input, scratch);
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match(std::string_view input, MatchScratch &scratch) const {
+  auto &plan = this->plan();
+  size_t offset = 0;
+
+  if (plan.window) {
+    auto window = match_window(input);
+    if (!window) { return std::nullopt; }
+    offset = window.value();
+  }
+
+  std::optional<std::pair<size_t, size_t>> result{};
+
+  // the literal and reversed searches read no more than the match,
+  // searching the input for the required characters would read more
+  if (plan.engine == MatchEngine::LITERAL) {
+    result = match_literal(input);
+  } else if (plan.engine == MatchEngine::REVERSE) {
+    result = match_reverse(input);
+  } else if (plan.required_chars && !has_required_chars(input)) {
+    return std::nullopt;
+  } else if (plan.engine == MatchEngine::SPLIT) {
+    // the longest match holds one occurrence of the string, the
+    // occurrences are found far faster than the automata steps
+    result = match_split(input, scratch.simulation);
+  } else if (
+      plan.engine == MatchEngine::BACKTRACK &&
+      input.size() <= plan.backtrack_limit
+  ) {
+    result = Automata::accept(program, input, scratch);
+  } else {
+    result = match_simulation(input, scratch.simulation);
+  }
+
+  if (!result) { return std::nullopt; }
+
+  return std::make_pair(result->first + offset, result->second + offset);
+}
+
+bool Regex::is_match(std::string_view input) const {
+  auto &plan = this->plan();
+
+  if (plan.window && !match_window(input)) { return false; }
+
+  if (plan.engine == MatchEngine::LITERAL) {
+    return match_literal(input).has_value();
+  }
+
+  if (plan.engine == MatchEngine::REVERSE) {
+    return match_reverse(input).has_value();
+  }
+
+  if (plan.required_chars && !has_required_chars(input)) { return false; }
+
+  thread_local MatchScratch scratch{};
+
+  // the first occurrence of the string with a match around it ends the
+  // search
+  if (plan.engine == MatchEngine::SPLIT) {
+    return match_split(input, scratch.simulation, true).has_value();
+  }
+
+  if (
+      plan.engine == MatchEngine::BACKTRACK &&
+      input.size() <= plan.backtrack_limit
+  ) {
+    return Automata::accept_any(program, input, scratch);
+  }
+
+  // the first accepting thread ends the pass, the start bytes are skipped
+  // while no attempt is running, the scratch is bound once per regex
+  scratch.simulation.bind(program, MatchPolicy::ANY);
+  return scratch.simulation.accept_any(input);
+}
+
+const Regex::LazyProgram &Regex::compile_lazy(
+    LazyProgram &lazy, MatchSemantics semantics, bool captures, bool reverse
+) const {
+  std::call_once(lazy.once, [&]() {
+    RegexTokenizer tokenizer{source()};
+    Parser parser{tokenizer, semantics, captures, reverse};
+
+    // the source was parsed once already
+    auto error = parser.build_graph();
+    regex_assert(!error);
+
+    lazy.group_size = parser.group_size;
+    lazy.program = Program::compile(parser.regex_graph, source(), semantics);
+  });
+
+  return lazy;
+}
+
+// the length of the longest match of a program anchored at its start,
+// stepped over the input forward or from its end backward, the steps stop
+// once no path is alive and are taken from the budget. A scan the budget
+// cannot pay for ends with nothing and the budget at 0
+static std::optional<size_t> longest_anchored(
+    Simulation &simulation, std::string_view input, bool backward,
+    size_t &budget
+) {
+  size_t offset = 0;
+
+  simulation.start(0);
+
+  for (; offset < input.size() && simulation.running(); ++offset) {
+    if (offset == budget) {
+      budget = 0;
+      return std::nullopt;
+    }
+
+    simulation.step(
+        offset, backward ? input[input.size() - 1 - offset] : input[offset]
+    );
+  }
+
+  if (simulation.running()) { simulation.finish(offset); }
+
+  budget -= offset;
+
+  if (!simulation.best()) { return std::nullopt; }
+  return simulation.best()->second;
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match_reverse(std::string_view input) const {
+  thread_local Simulation simulation{};
+  size_t budget = input.size();
+
+  simulation.bind(compile_reverse().program.value(), MatchPolicy::LONGEST);
+
+  // every match ends at the end of input, the longest one is the match
+  // under both semantics
+  auto length = longest_anchored(simulation, input, true, budget);
+  if (!length) { return std::nullopt; }
+
+  return std::make_pair(input.size() - length.value(), input.size());
+}
+
+const Regex::SplitProgram &Regex::compile_split() const {
+  std::call_once(split_program->once, [this]() {
+    auto compile_part = [this](ParsePart part, bool reverse) {
+      RegexTokenizer tokenizer{source()};
+      Parser parser{tokenizer, MatchSemantics::LONGEST, false, reverse};
+
+      parser.part = part;
+      parser.part_index = program.split_index().value();
+
+      // the source was parsed once already
+      auto error = parser.build_graph();
+      regex_assert(!error);
+
+      return Program::compile(parser.regex_graph, source());
+    };
+
+    split_program->before = compile_part(ParsePart::BEFORE, true);
+    split_program->after = compile_part(ParsePart::AFTER, false);
+  });
+
+  return *split_program;
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match_split(
+    std::string_view input, Simulation &simulation, bool any
+) const {
+  auto &split = compile_split();
+  auto literal = program.split_string();
+
+  thread_local Simulation before{};
+  thread_local Simulation after{};
+
+  before.bind(split.before.value(), MatchPolicy::LONGEST);
+  after.bind(split.after.value(), MatchPolicy::LONGEST);
+
+  std::optional<std::pair<size_t, size_t>> best{};
+  // the scans of many occurrences may read the same input again and again,
+  // the search gives up within a scan once they read too much
+  size_t budget = SPLIT_SCAN_FACTOR * input.size();
+
+  for (
+      auto position = input.find(literal);
+      position != std::string_view::npos;
+      position = input.find(literal, position + 1)
+  ) {
+    auto end_length = longest_anchored(
+        after, input.substr(position + literal.size()), false, budget
+    );
+    if (budget == 0) { return match_simulation(input, simulation); }
+    if (!end_length) { continue; }
+
+    auto begin_length = longest_anchored(
+        before, input.substr(0, position), true, budget
+    );
+    if (budget == 0) { return match_simulation(input, simulation); }
+    if (!begin_length) { continue; }
+
+    auto begin = position - begin_length.value();
+    auto end = position + literal.size() + end_length.value();
+
+    if (any) { return std::make_pair(begin, end); }
+
+    if (
+        !best || end - begin > best->second - best->first ||
+        (end - begin == best->second - best->first && begin < best->first)
+    ) {
+      best = std::make_pair(begin, end);
+    }
+  }
+
+  return best;
+}
+
+size_t Regex::find_literal(std::string_view input, size_t offset) const {
+  if (offset > input.size()) { return std::string_view::npos; }
+
+  auto found = memmem(
+      input.data() + offset, input.size() - offset, literal->data(),
+      literal->size()
+  );
+  if (found == nullptr) { return std::string_view::npos; }
+
+  return static_cast<const char *>(found) - input.data();
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match_literal(std::string_view input) const {
+  auto size = literal->size();
+  size_t position = 0;
+
+  if (program.is_anchored()) {
+    if (
+        !input.starts_with(literal.value()) ||
+        (program.is_end_anchored() && input.size() != size)
+    ) {
+      return std::nullopt;
+    }
+  } else if (program.is_end_anchored()) {
+    if (!input.ends_with(literal.value())) { return std::nullopt; }
+    position = input.size() - size;
+  } else {
+    // every match has the same length, the first one is the match under
+    // both semantics
+    position = find_literal(input, 0);
+    if (position == std::string_view::npos) { return std::nullopt; }
+  }
+
+  return std::make_pair(position, position + size);
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match_simulation(
+    std::string_view input, Simulation &simulation
+) const {
+  size_t offset = 0;
+
+  simulation.bind(program, match_policy(program));
+  simulation.start(0);
+
+  for (; offset < input.size() && simulation.running(); ++offset) {
+    simulation.step(offset, input[offset]);
   }
+
+  if (simulation.running()) { simulation.finish(offset); }
+
+  return simulation.best();
 }
 
-std::optional<std::pair<size_t, size_t>> Regex::match(std::string_view input) {
-  if (!check_ascii(input)) { regex_warn("input string includes none ascii"); }
+std::optional<Regex::Captures>
+Regex::captures(std::string_view input) const {
+  auto &plan = this->plan();
+  std::optional<size_t> window{0};
+
+  if (plan.window) { window = match_window(input); }
+
+  if (
+      !window || (plan.required_chars && !has_required_chars(input))
+  ) {
+    return std::nullopt;
+  }
+
+  auto &capture = compile_captures();
+  auto &tagged = capture.program.value();
+
+  thread_local Simulation simulation{};
+  size_t offset = 0;
+
+  simulation.bind(tagged, match_policy(tagged));
+  simulation.start(0);
+
+  for (; offset < input.size() && simulation.running(); ++offset) {
+    simulation.step(offset, input[offset]);
+  }
+
+  if (simulation.running()) { simulation.finish(offset); }
+
+  if (!simulation.best()) { return std::nullopt; }
+
+  // offsets in the window count from its start
+  auto range = [&window](size_t begin, size_t end) {
+    return std::make_pair(begin + window.value(), end + window.value());
+  };
+
+  Captures result{
+    range(simulation.best()->first, simulation.best()->second)
+  };
+
+  for (uint32_t group = 1; group <= capture.group_size; ++group) {
+    auto begin = simulation.best_tag(group * 2);
+    auto end = simulation.best_tag(group * 2 + 1);
+
+    if (begin == Simulation::NO_START || end == Simulation::NO_START) {
+      result.emplace_back(std::nullopt);
+    } else {
+      result.emplace_back(range(begin, end));
+    }
+  }
+
+  return result;
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match(std::span<const std::string_view> segments) const {
+  size_t input_size = 0;
+  for (auto segment : segments) { input_size += segment.size(); }
+
+  auto &plan = this->plan();
+
+  if (plan.window && input_size < program.min_length()) {
+    return std::nullopt;
+  }
+
+  std::string_view checked_chars{};
+  if (plan.required_chars) { checked_chars = required_chars; }
+
+  for (char c : checked_chars) {
+    bool found = false;
+
+    for (auto segment : segments) {
+      if (segment.find(c) != std::string_view::npos) {
+        found = true;
+        break;
+      }
+    }
+
+    if (!found) { return std::nullopt; }
+  }
+
+  // the backtracking automata needs the input in one piece, the simulation
+  // steps the segments in place
+  Simulation simulation{program, match_policy(program)};
+  size_t offset = 0;
+
+  simulation.start(0);
+
+  for (auto segment : segments) {
+    for (char c : segment) {
+      if (!simulation.running()) { return simulation.best(); }
+      simulation.step(offset++, c);
+    }
+  }
+
+  if (simulation.running()) { simulation.finish(offset); }
+
+  return simulation.best();
+}
+
+size_t Regex::find_all(
+    std::string_view input, std::vector<std::pair<size_t, size_t>> &matches
+) const {
+  matches.clear();
+
+  if (is_rejected(input)) { return 0; }
+
+  if (
+      plan().engine == MatchEngine::LITERAL && !program.is_anchored() &&
+      !program.is_end_anchored()
+  ) {
+    for (
+        auto position = find_literal(input, 0);
+        position != std::string_view::npos;
+        position = find_literal(input, position + literal->size())
+    ) {
+      matches.emplace_back(position, position + literal->size());
+    }
+
+    return matches.size();
+  }
+
+  MatchFinder finder{program, input};
+  while (auto match = finder.next()) { matches.push_back(match.value()); }
+
+  return matches.size();
+}
+
+size_t Regex::count(std::string_view input) const {
+  if (is_rejected(input)) { return 0; }
+
+  size_t result = 0;
+
+  if (
+      plan().engine == MatchEngine::LITERAL && !program.is_anchored() &&
+      !program.is_end_anchored()
+  ) {
+    for (
+        auto position = find_literal(input, 0);
+        position != std::string_view::npos;
+        position = find_literal(input, position + literal->size())
+    ) {
+      ++result;
+    }
+
+    return result;
+  }
+
+  MatchFinder finder{program, input};
+
+  while (finder.next()) { ++result; }
+
+  return result;
+}
+
+std::optional<std::pair<size_t, size_t>>
+Regex::match_parallel(std::string_view input, size_t thread_size) const {
+  // the literal, reversed and split searches read little of the input,
+  // only the Simulation steps all of it
+  if (plan().engine != MatchEngine::SIMULATION) { return match(input); }
+
+  if (is_rejected(input)) { return std::nullopt; }
+
+  // every chunk is searched up to its end as if no match attempt was
+  // running at its start. The attempts still running at the end of a chunk
+  // are then stepped through the next chunk alone and joined to its
+  // attempts, chunk after chunk, which gives the state of one search over
+  // the whole input. A regex matching only at the start of input has only
+  // one chunk
+  thread_size = std::max<size_t>(thread_size, 1);
+
+  size_t chunk_size = std::max(
+      PARALLEL_CHUNK_SIZE, (input.size() + thread_size - 1) / thread_size
+  );
+  size_t chunk_count = program.is_anchored() ?
+      1 : std::max<size_t>(1, (input.size() + chunk_size - 1) / chunk_size);
+
+  auto chunk_end = [&](size_t index) {
+    return index + 1 == chunk_count ?
+        input.size() : std::min((index + 1) * chunk_size, input.size());
+  };
+
+  std::vector<Simulation> simulations{};
+
+  for (size_t i = 0; i < chunk_count; ++i) {
+    simulations.emplace_back(program, match_policy(program));
+  }
+
+  auto search_chunk = [&](size_t index) {
+    auto &simulation = simulations[index];
+    size_t end = chunk_end(index);
+
+    simulation.start(index * chunk_size);
+
+    for (
+        size_t offset = index * chunk_size;
+        offset < end && simulation.running(); ++offset
+    ) {
+      simulation.step(offset, input[offset]);
+    }
+  };
+
+  std::vector<std::thread> threads{};
+
+  for (size_t i = 1; i < chunk_count; ++i) {
+    threads.emplace_back(search_chunk, i);
+  }
+
+  search_chunk(0);
+
+  for (auto &thread : threads) { thread.join(); }
+
+  for (size_t i = 1; i < chunk_count; ++i) {
+    auto &earlier = simulations[i - 1];
+    size_t end = chunk_end(i);
+
+    earlier.drop_prefix();
+
+    for (
+        size_t offset = i * chunk_size;
+        offset < end && earlier.running(); ++offset
+    ) {
+      earlier.step(offset, input[offset]);
+    }
+
+    simulations[i].carry(earlier);
+  }
+
+  auto &simulation = simulations.back();
+  if (simulation.running()) { simulation.finish(input.size()); }
 
-  return Automata::accept(graph, input);
+  return simulation.best();
 }
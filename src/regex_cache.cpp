@@ -0,0 +1,97 @@
+#include "regex_cache.hpp"
+
+
+RegexCache &RegexCache::global() {
+  static RegexCache cache{};
+  return cache;
+}
+
+void RegexCache::shrink(Shard &shard, size_t capacity) {
+  while (shard.entries.size() > capacity) {
+    auto &entry = shard.entries.back();
+    shard.index.erase(Key{entry.regex, entry.semantics});
+    shard.entries.pop_back();
+    eviction.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+RegexCache::RegexPtr RegexCache::get(
+    std::string_view regex, MatchSemantics semantics
+) {
+  Key key{regex, semantics};
+  auto &shard = get_shard(key);
+
+  {
+    std::lock_guard guard{shard.mutex};
+
+    auto ptr = shard.index.find(key);
+    if (ptr != shard.index.end()) {
+      shard.entries.splice(shard.entries.begin(), shard.entries, ptr->second);
+      hit.fetch_add(1, std::memory_order_relaxed);
+      return ptr->second->compiled;
+    }
+  }
+
+  miss.fetch_add(1, std::memory_order_relaxed);
+
+  // compile without holding the lock, other threads may compile the same
+  // regex meanwhile, the first one inserted wins
+  auto compiled = Regex::init(regex, semantics);
+  if (!compiled) { return nullptr; }
+
+  auto result = std::make_shared<const Regex>(std::move(compiled.value()));
+
+  std::lock_guard guard{shard.mutex};
+
+  auto ptr = shard.index.find(key);
+  if (ptr != shard.index.end()) {
+    shard.entries.splice(shard.entries.begin(), shard.entries, ptr->second);
+    return ptr->second->compiled;
+  }
+
+  shard.entries.emplace_front(Entry{
+    .regex = std::string{regex}, .semantics = semantics, .compiled = result
+  });
+  shard.index.emplace(
+      Key{shard.entries.front().regex, semantics}, shard.entries.begin()
+  );
+  shrink(shard, shard_capacity.load(std::memory_order_relaxed));
+
+  return result;
+}
+
+void RegexCache::set_capacity(size_t capacity) {
+  size_t new_capacity = (capacity + SHARD_SIZE - 1) / SHARD_SIZE;
+  if (new_capacity == 0) { new_capacity = 1; }
+
+  shard_capacity.store(new_capacity, std::memory_order_relaxed);
+
+  for (auto &shard : shards) {
+    std::lock_guard guard{shard.mutex};
+    shrink(shard, new_capacity);
+  }
+}
+
+void RegexCache::clear() {
+  for (auto &shard : shards) {
+    std::lock_guard guard{shard.mutex};
+    shard.index.clear();
+    shard.entries.clear();
+  }
+}
+
+RegexCache::Statistics RegexCache::statistics() {
+  size_t size = 0;
+
+  for (auto &shard : shards) {
+    std::lock_guard guard{shard.mutex};
+    size += shard.entries.size();
+  }
+
+  return Statistics{
+    .hit = hit.load(std::memory_order_relaxed),
+    .miss = miss.load(std::memory_order_relaxed),
+    .eviction = eviction.load(std::memory_order_relaxed),
+    .size = size,
+  };
+}
@@ -0,0 +1,73 @@
+#include "regex_handle.hpp"
+
+
+HazardDomain &HazardDomain::global() {
+  static HazardDomain domain{};
+  return domain;
+}
+
+HazardDomain::Record *HazardDomain::acquire() {
+  // reuse the record of an exited thread
+  for (
+      auto record = records.load(std::memory_order_acquire);
+      record != nullptr;
+      record = record->next
+  ) {
+    bool active = false;
+    if (record->active.compare_exchange_strong(active, true)) {
+      return record;
+    }
+  }
+
+  auto record = new Record{};
+
+  for (auto &slot : record->slots) { slot.store(nullptr); }
+  record->active.store(true);
+  record->used = 0;
+  record->next = records.load(std::memory_order_relaxed);
+
+  while (!records.compare_exchange_weak(
+      record->next, record,
+      std::memory_order_release, std::memory_order_relaxed
+  )) {}
+
+  return record;
+}
+
+void HazardDomain::release(Record &record) {
+  for (auto &slot : record.slots) {
+    slot.store(nullptr, std::memory_order_release);
+  }
+  record.used = 0;
+  record.active.store(false, std::memory_order_release);
+}
+
+struct ThreadRecord {
+  HazardDomain::Record *record{nullptr};
+
+  ~ThreadRecord() {
+    if (record != nullptr) { HazardDomain::global().release(*record); }
+  }
+};
+
+HazardDomain::Record &HazardDomain::local() {
+  thread_local ThreadRecord thread_record{};
+
+  if (thread_record.record == nullptr) { thread_record.record = acquire(); }
+
+  return *thread_record.record;
+}
+
+bool HazardDomain::is_protected(const void *ptr) {
+  for (
+      auto record = records.load(std::memory_order_acquire);
+      record != nullptr;
+      record = record->next
+  ) {
+    for (auto &slot : record->slots) {
+      if (slot.load(std::memory_order_seq_cst) == ptr) { return true; }
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,176 @@
+#include "regex_set.hpp"
+
+#include "tokenizer.hpp"
+#include "parser.hpp"
+
+
+std::optional<RegexSet::Part> RegexSet::compile(
+    const std::vector<std::string_view> &regexes,
+    std::vector<size_t> &&regex_index
+) {
+  std::vector<RegGraph> graphs{};
+  std::string source{};
+
+  graphs.reserve(regexes.size());
+
+  for (size_t i = 0; i < regexes.size(); ++i) {
+    RegexTokenizer tokenizer{regexes[i]};
+    Parser parser{tokenizer};
+
+    if (auto error = parser.build_graph()) {
+      regex_warn(error->c_str());
+      return std::nullopt;
+    }
+
+    parser.regex_graph.set_pattern(i);
+    graphs.emplace_back(std::move(parser.regex_graph));
+
+    if (i > 0) { source.push_back('\n'); }
+    source.append(regexes[i]);
+  }
+
+  // bisimulation merges the common prefixes of the regexes
+  auto graph = RegGraph::union_graph(std::move(graphs));
+  graph.optimize_graph();
+
+  return Part{
+    .program = Program::compile(graph, source),
+    .regex_index = std::move(regex_index),
+  };
+}
+
+void RegexSet::compact() {
+  std::vector<std::string_view> regexes{};
+  std::vector<size_t> regex_index{};
+
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (!removed[i]) {
+      regexes.emplace_back(sources[i]);
+      regex_index.emplace_back(i);
+    }
+  }
+
+  parts.clear();
+  removed_size = 0;
+
+  if (!regexes.empty()) {
+    auto part = compile(regexes, std::move(regex_index));
+    regex_assert(part.has_value());
+    parts.emplace_back(std::move(part.value()));
+  }
+}
+
+std::optional<RegexSet>
+RegexSet::init(const std::vector<std::string_view> &regexes) {
+  RegexSet set{};
+
+  if (!set.add(regexes)) { return std::nullopt; }
+
+  return set;
+}
+
+std::optional<size_t> RegexSet::add(std::string_view regex) {
+  if (auto index = add(std::vector<std::string_view>{regex})) {
+    return index->front();
+  } else {
+    return std::nullopt;
+  }
+}
+
+std::optional<std::vector<size_t>>
+RegexSet::add(const std::vector<std::string_view> &regexes) {
+  std::vector<size_t> regex_index{};
+
+  for (size_t i = 0; i < regexes.size(); ++i) {
+    regex_index.emplace_back(sources.size() + i);
+  }
+
+  if (regexes.empty()) { return regex_index; }
+
+  auto part = compile(regexes, std::vector<size_t>{regex_index});
+  if (!part) { return std::nullopt; }
+
+  parts.emplace_back(std::move(part.value()));
+
+  for (auto regex : regexes) {
+    sources.emplace_back(regex);
+    removed.emplace_back(false);
+  }
+
+  if (parts.size() > DELTA_LIMIT + 1) { compact(); }
+
+  return regex_index;
+}
+
+bool RegexSet::remove(size_t index) {
+  if (!contains(index)) { return false; }
+
+  removed[index] = true;
+  removed_size += 1;
+
+  sources[index].clear();
+  sources[index].shrink_to_fit();
+
+  if (removed_size * 2 > sources.size()) { compact(); }
+
+  return true;
+}
+
+template<class Fn>
+void RegexSet::run(
+    std::string_view input, MatchScratch &scratch, Fn fn
+) const {
+  auto &simulation = scratch.simulation;
+
+  // the paths of all patterns are stepped at once, the time is linear in
+  // the input whatever patterns the set holds
+  for (auto &part : parts) {
+    size_t offset = 0;
+
+    simulation.bind(part.program, MatchPolicy::LONGEST);
+    simulation.start(0);
+
+    for (; offset < input.size() && simulation.running(); ++offset) {
+      simulation.step(offset, input[offset]);
+    }
+
+    if (simulation.running()) { simulation.finish(offset); }
+
+    for (size_t i = 0; i < part.regex_index.size(); ++i) {
+      auto index = part.regex_index[i];
+      if (!removed[index]) { fn(index, simulation.best(i)); }
+    }
+  }
+}
+
+std::vector<bool> RegexSet::matches(std::string_view input) const {
+  thread_local MatchScratch scratch{};
+  return matches(input, scratch);
+}
+
+std::vector<bool>
+RegexSet::matches(std::string_view input, MatchScratch &scratch) const {
+  std::vector<bool> result(size(), false);
+
+  run(input, scratch, [&result](size_t index, const MatchResult &match) {
+    result[index] = match.has_value();
+  });
+
+  return result;
+}
+
+std::vector<MatchResult> RegexSet::match(std::string_view input) const {
+  thread_local MatchScratch scratch{};
+  return match(input, scratch);
+}
+
+std::vector<MatchResult>
+RegexSet::match(std::string_view input, MatchScratch &scratch) const {
+  std::vector<MatchResult> result(size(), std::nullopt);
+
+  run(input, scratch, [&result](size_t index, const MatchResult &match) {
+    result[index] = match;
+  });
+
+  return result;
+}
@@ -0,0 +1,90 @@
+#include "regex_stream.hpp"
+
+
+RegexStream::RegexStream(const Program &program) :
+    simulation{program}, anchored{program.is_anchored()}, window{},
+    window_offset{0}, offset{0}, search_start{0}, searching{false},
+    matches{} {}
+
+void RegexStream::run(bool end) {
+  auto window_end = window_offset + window.size();
+
+  while (true) {
+    if (!searching) {
+      if (search_start == NO_START || search_start > window_end) { break; }
+
+      simulation.start(search_start);
+      offset = search_start;
+      searching = true;
+    }
+
+    while (offset < window_end && simulation.running()) {
+      simulation.step(offset, window[offset - window_offset]);
+      ++offset;
+    }
+
+    if (simulation.running()) {
+      if (!end) { break; }
+      simulation.finish(offset);
+    }
+
+    searching = false;
+
+    auto &best = simulation.best();
+
+    if (!best || anchored) {
+      // an anchored regex only matches at the start of the stream
+      search_start = NO_START;
+      if (best) { matches.push_back(best.value()); }
+      break;
+    }
+
+    matches.push_back(best.value());
+
+    // the next search starts after the match, an empty match is not found
+    // twice at the same offset
+    auto [begin, match_end] = best.value();
+    search_start = begin == match_end ? match_end + 1 : match_end;
+  }
+
+  // drop the input no search will step again, a running search never
+  // steps back, the next one starts at the end of the best match or not
+  // at all, a later best match ends after it
+  size_t keep = window_end;
+
+  if (searching) {
+    auto &best = simulation.best();
+    keep = best ? best->second : offset;
+  } else if (search_start != NO_START) {
+    keep = std::min(search_start, window_end);
+  }
+
+  if (keep > window_offset) {
+    window.erase(0, keep - window_offset);
+    window_offset = keep;
+  }
+}
+
+const std::vector<RegexStream::MatchRange> &
+RegexStream::feed(std::string_view chunk) {
+  matches.clear();
+  window.append(chunk);
+  run(false);
+  return matches;
+}
+
+const std::vector<RegexStream::MatchRange> &RegexStream::finish() {
+  matches.clear();
+  run(true);
+  search_start = NO_START;
+  return matches;
+}
+
+void RegexStream::reset() {
+  window.clear();
+  window_offset = 0;
+  offset = 0;
+  search_start = 0;
+  searching = false;
+  matches.clear();
+}
@@ -0,0 +1,552 @@
+#include "simulation.hpp"
+
+#include <set>
+#include <tuple>
+
+
+Simulation::Simulation() :
+    program{nullptr}, image_id{0}, policy{MatchPolicy::LEFTMOST_LONGEST},
+    node_threads{false}, edge_slot{},
+    start_byte{}, current{}, next{}, next_prefix{}, stack{}, loops{},
+    loop_index{}, stamp{0}, node_mark{}, slot_mark{}, node_loop_mark{},
+    slot_loop_mark{}, tag_size{0}, capture_slots{},
+    capture_limit{MIN_CAPTURE_LIMIT}, capture_map{}, capture_spare{},
+    best_match{}, best_captures{NO_CAPTURES}, end_start{NO_START},
+    end_captures{NO_CAPTURES}, pattern_match{}, pattern_end_start{},
+    end_patterns{} {}
+
+void Simulation::bind(const Program &other, MatchPolicy other_policy) {
+  program = &other;
+
+  // the slots and the start bytes only depend on the image and the policy,
+  // a scratch bound again to the same ones allocates nothing
+  if (image_id != other.image_id() || policy != other_policy) {
+    image_id = other.image_id();
+    policy = other_policy;
+    build_slots();
+    build_start_byte();
+  }
+
+  current.clear();
+  capture_slots.clear();
+  best_match.reset();
+  best_captures = NO_CAPTURES;
+  end_start = NO_START;
+  end_captures = NO_CAPTURES;
+
+  if (program->pattern_size() > 1) {
+    // other policies prune paths by the best match of any pattern
+    regex_assert(policy == MatchPolicy::LONGEST);
+
+    pattern_match.assign(program->pattern_size(), std::nullopt);
+    pattern_end_start.assign(program->pattern_size(), NO_START);
+  } else {
+    pattern_match.clear();
+    pattern_end_start.clear();
+  }
+  end_patterns.clear();
+}
+
+void Simulation::build_slots() {
+  uint32_t slot_size = 0;
+
+  edge_slot.clear();
+  tag_size = 0;
+
+  for (uint32_t i = 0; i < program->edge_size(); ++i) {
+    auto &edge = program->edge(i);
+
+    edge_slot.push_back(slot_size);
+
+    switch (Program::edge_type(edge)) {
+      case EdgeType::CONCATENATION:
+        slot_size += edge.size;
+        break;
+      case EdgeType::CHARACTER_SET:
+        slot_size += 1;
+        break;
+      case EdgeType::TAG:
+        tag_size = std::max<size_t>(tag_size, edge.value + 1);
+        break;
+      default:
+        break;
+    }
+  }
+
+  // capture tags are recorded by the first path in the order of edges
+  node_threads = policy != MatchPolicy::LEFTMOST_FIRST && tag_size == 0;
+
+  // marks left by another program are older than any later stamp
+  node_mark.resize(program->node_size(), 0);
+  slot_mark.resize(slot_size, 0);
+}
+
+void Simulation::build_start_byte() {
+  start_byte.fill(true);
+
+  if (program->is_anchored()) { return; }
+
+  // the first characters consumed after MATCH_BEGIN, loop counters are not
+  // checked so the set may be larger than needed
+  CharacterSet first{};
+  std::vector<bool> visited(program->node_size(), false);
+  std::vector<uint32_t> nodes{};
+
+  for (uint32_t i = 0; i < program->node_size(); ++i) {
+    if (program->marker(i) == NodeMarker::MATCH_BEGIN) {
+      visited[i] = true;
+      nodes.push_back(i);
+    }
+  }
+
+  while (!nodes.empty()) {
+    auto index = nodes.back();
+    nodes.pop_back();
+
+    // a match may be empty, it may start anywhere
+    if (program->marker(index) == NodeMarker::MATCH_END) { return; }
+
+    auto &node = program->node(index);
+
+    for (auto i = node.edge_begin; i < node.edge_end; ++i) {
+      auto &edge = program->edge(i);
+      auto type = Program::edge_type(edge);
+
+      if (type == EdgeType::CHARACTER_SET) {
+        first |= program->set(edge);
+      } else if (type == EdgeType::CONCATENATION && edge.size != 0) {
+        first.set_char(program->string(edge)[0]);
+      } else if (!visited[edge.dest]) {
+        visited[edge.dest] = true;
+        nodes.push_back(edge.dest);
+      }
+    }
+  }
+
+  for (size_t c = 0; c < 128; ++c) { start_byte[c] = first.has_char(c); }
+}
+
+void Simulation::next_stamp() {
+  if (++stamp == 0) {
+    std::fill(node_mark.begin(), node_mark.end(), 0);
+    std::fill(slot_mark.begin(), slot_mark.end(), 0);
+    stamp = 1;
+  }
+
+  if (!node_loop_mark.empty()) { node_loop_mark.clear(); }
+  if (!slot_loop_mark.empty()) { slot_loop_mark.clear(); }
+}
+
+uint32_t Simulation::push_loop(uint32_t parent, size_t count) {
+  uint64_t key =
+      static_cast<uint64_t>(parent) << 32 |
+      std::min<size_t>(count, UINT32_MAX);
+  auto [iter, inserted] = loop_index.emplace(key, loops.size());
+
+  if (inserted) {
+    loops.emplace_back(LoopFrame{
+      .parent = parent,
+      .count = static_cast<uint32_t>(std::min<size_t>(count, UINT32_MAX)),
+    });
+  }
+
+  return iter->second;
+}
+
+bool Simulation::visit_node(uint32_t node, uint32_t loop) {
+  if (loop == NO_LOOP) {
+    if (node_mark[node] == stamp) { return false; }
+    node_mark[node] = stamp;
+    return true;
+  }
+
+  return node_loop_mark.insert(static_cast<uint64_t>(node) << 32 | loop).second;
+}
+
+void Simulation::add_thread(
+    uint32_t edge, uint32_t progress, uint32_t loop, uint32_t captures,
+    size_t start
+) {
+  auto slot = edge_slot[edge] + progress;
+
+  if (loop == NO_LOOP) {
+    if (slot_mark[slot] == stamp) { return; }
+    slot_mark[slot] = stamp;
+  } else {
+    auto key = static_cast<uint64_t>(slot) << 32 | loop;
+    if (!slot_loop_mark.insert(key).second) { return; }
+  }
+
+  (start == NO_START ? next_prefix : next).emplace_back(Thread{
+    .edge = edge, .progress = progress, .loop = loop, .captures = captures,
+    .start = start
+  });
+}
+
+uint32_t Simulation::set_tag(uint32_t captures, uint32_t tag, size_t offset) {
+  auto index = capture_slots.size() / tag_size;
+
+  if (captures == NO_CAPTURES) {
+    capture_slots.resize(capture_slots.size() + tag_size, NO_START);
+  } else {
+    if (capture_slots[captures * tag_size + tag] == offset) { return captures; }
+
+    auto begin = captures * tag_size;
+    for (size_t i = 0; i < tag_size; ++i) {
+      capture_slots.push_back(capture_slots[begin + i]);
+    }
+  }
+
+  capture_slots[index * tag_size + tag] = offset;
+
+  return index;
+}
+
+void Simulation::collect_captures() {
+  auto size = capture_slots.size() / tag_size;
+
+  if (size < capture_limit) { return; }
+
+  // live arrays are copied in the order they are found
+  capture_map.assign(size, NO_CAPTURES);
+  capture_spare.clear();
+
+  auto keep = [this](uint32_t &captures) {
+    if (captures == NO_CAPTURES) { return; }
+
+    if (capture_map[captures] == NO_CAPTURES) {
+      capture_map[captures] = capture_spare.size() / tag_size;
+
+      auto begin = capture_slots.begin() + captures * tag_size;
+      capture_spare.insert(capture_spare.end(), begin, begin + tag_size);
+    }
+
+    captures = capture_map[captures];
+  };
+
+  for (auto &thread : current) { keep(thread.captures); }
+  keep(best_captures);
+  keep(end_captures);
+
+  std::swap(capture_slots, capture_spare);
+  capture_limit = std::max(
+      MIN_CAPTURE_LIMIT, capture_slots.size() / tag_size * 2
+  );
+}
+
+bool Simulation::add_closure(
+    uint32_t node, uint32_t loop, uint32_t captures, size_t start,
+    size_t offset
+) {
+  stack.emplace_back(ClosureElem{
+    .node = node, .loop = loop, .captures = captures, .start = start
+  });
+
+  while (!stack.empty()) {
+    auto [index, loop, captures, start, thread_edge] = stack.back();
+    stack.pop_back();
+
+    if (thread_edge != NO_EDGE) {
+      if (!is_pruned(start)) {
+        add_thread(thread_edge, 0, loop, captures, start);
+      }
+      continue;
+    }
+
+    if (!visit_node(index, loop)) { continue; }
+
+    auto marker = program->marker(index);
+
+    if (marker == NodeMarker::MATCH_BEGIN) {
+      if (offset < start) { start = offset; }
+    } else if (marker == NodeMarker::MATCH_END) {
+      auto pattern = program->node(index).pattern;
+
+      if (program->is_universal(index)) {
+        // the rest of the input is always accepted, nothing after the
+        // match end can change the match
+        set_match(start, offset, captures);
+
+        if (!pattern_match.empty()) {
+          set_pattern_match(pattern, start, offset);
+        }
+
+        if (policy == MatchPolicy::LEFTMOST_FIRST) {
+          // paths tried after this one can never be the match, the match
+          // attempts not started yet come last of all
+          stack.clear();
+          next_prefix.clear();
+          return true;
+        }
+
+        continue;
+      }
+
+      if (start < end_start) {
+        end_start = start;
+        end_captures = captures;
+      }
+
+      if (!pattern_match.empty()) {
+        auto &pattern_start = pattern_end_start[pattern];
+
+        if (pattern_start == NO_START) { end_patterns.push_back(pattern); }
+        pattern_start = std::min(pattern_start, start);
+      }
+    }
+
+    if (is_pruned(start)) { continue; }
+
+    auto &node = program->node(index);
+    bool node_thread = node_threads && node.dispatch != Program::NO_DISPATCH;
+
+    if (node_thread) {
+      (start == NO_START ? next_prefix : next).emplace_back(Thread{
+        .edge = index, .progress = AT_NODE, .loop = loop,
+        .captures = captures, .start = start
+      });
+    }
+
+    // edges are pushed in reverse to be expanded in their order
+    for (auto i = node.edge_end; i-- > node.edge_begin;) {
+      auto &edge = program->edge(i);
+      auto dest = edge.dest;
+
+      switch (Program::edge_type(edge)) {
+        case EdgeType::EMPTY:
+          stack.emplace_back(ClosureElem{dest, loop, captures, start});
+          break;
+        case EdgeType::TAG:
+          stack.emplace_back(ClosureElem{
+            dest, loop, set_tag(captures, edge.value, offset), start
+          });
+          break;
+        case EdgeType::ENTER_LOOP:
+          stack.emplace_back(ClosureElem{
+            dest, push_loop(loop, 1), captures, start
+          });
+          break;
+        case EdgeType::EXIT_LOOP:
+          if (Program::range(edge).in_range(loops[loop].count)) {
+            stack.emplace_back(ClosureElem{
+              dest, loops[loop].parent, captures, start
+            });
+          }
+          break;
+        case EdgeType::REPEAT: {
+          auto range = Program::range(edge);
+          size_t count = loops[loop].count + 1;
+
+          if (range.in_upper_range(count)) {
+            if (range.upper_bound == 0) {
+              count = std::min(count, range.lower_bound);
+            }
+
+            auto frame = push_loop(loops[loop].parent, count);
+            stack.emplace_back(ClosureElem{dest, frame, captures, start});
+          }
+          break;
+        }
+        case EdgeType::CONCATENATION:
+          if (edge.size == 0) {
+            stack.emplace_back(ClosureElem{dest, loop, captures, start});
+          } else if (!node_thread) {
+            stack.emplace_back(ClosureElem{dest, loop, captures, start, i});
+          }
+          break;
+        case EdgeType::CHARACTER_SET:
+          if (!node_thread) {
+            stack.emplace_back(ClosureElem{dest, loop, captures, start, i});
+          }
+          break;
+        default:
+          regex_abort("unknown edge type");
+      }
+    }
+  }
+
+  return false;
+}
+
+void Simulation::swap_threads() {
+  next.insert(next.end(), next_prefix.begin(), next_prefix.end());
+  next_prefix.clear();
+  std::swap(current, next);
+
+  if (tag_size != 0) { collect_captures(); }
+}
+
+void Simulation::start(size_t offset) {
+  current.clear();
+  next.clear();
+  loops.clear();
+  loop_index.clear();
+  capture_slots.clear();
+  capture_limit = MIN_CAPTURE_LIMIT;
+  best_match.reset();
+  best_captures = NO_CAPTURES;
+  end_captures = NO_CAPTURES;
+  clear_end();
+
+  for (auto &match : pattern_match) { match.reset(); }
+
+  next_stamp();
+  add_closure(program->head(), NO_LOOP, NO_CAPTURES, NO_START, offset);
+  swap_threads();
+}
+
+void Simulation::step(size_t offset, char c) {
+  next.clear();
+  clear_end();
+  next_stamp();
+
+  for (auto &[edge_index, progress, loop, captures, start] : current) {
+    // threads are ordered by start, the rest are pruned too
+    if (is_pruned(start)) { break; }
+
+    if (progress != AT_NODE) {
+      if (step_edge(edge_index, progress, loop, captures, start, offset, c)) {
+        break;
+      }
+      continue;
+    }
+
+    // the edges consuming no input were expanded by the closure
+    auto &node = program->node(edge_index);
+    auto [begin, end] = program->dispatch(node, Node::dispatch_slot(c));
+
+    for (auto index = begin; index != end; ++index) {
+      auto edge = node.edge_begin + *index;
+      auto type = Program::edge_type(program->edge(edge));
+
+      if (type == EdgeType::CHARACTER_SET || type == EdgeType::CONCATENATION) {
+        step_edge(edge, 0, loop, captures, start, offset, c);
+      }
+    }
+  }
+
+  swap_threads();
+}
+
+bool Simulation::step_edge(
+    uint32_t edge_index, uint32_t progress, uint32_t loop, uint32_t captures,
+    size_t start, size_t offset, char c
+) {
+  auto &edge = program->edge(edge_index);
+
+  if (Program::edge_type(edge) == EdgeType::CHARACTER_SET) {
+    return
+        program->set(edge).has_char(c) &&
+        add_closure(edge.dest, loop, captures, start, offset + 1);
+  }
+
+  if (edge.size == 0 || program->string(edge)[progress] != c) { return false; }
+
+  if (progress + 1 == edge.size) {
+    return add_closure(edge.dest, loop, captures, start, offset + 1);
+  }
+
+  add_thread(edge_index, progress + 1, loop, captures, start);
+  return false;
+}
+
+void Simulation::finish(size_t offset) {
+  if (end_start != NO_START) { set_match(end_start, offset, end_captures); }
+
+  for (auto pattern : end_patterns) {
+    set_pattern_match(pattern, pattern_end_start[pattern], offset);
+  }
+
+  current.clear();
+  clear_end();
+}
+
+void Simulation::carry(const Simulation &earlier) {
+  regex_assert(
+      earlier.image_id == image_id && earlier.policy == policy &&
+      tag_size == 0
+  );
+
+  // every thread of the earlier search starts before the threads of this
+  // one, under the leftmost policies its match prunes them all
+  if (policy != MatchPolicy::LONGEST && earlier.best_match) {
+    current.clear();
+    best_match = earlier.best_match;
+    end_start = earlier.end_start;
+  } else {
+    if (earlier.best_match) {
+      auto [begin, end] = earlier.best_match.value();
+      set_match(begin, end, NO_CAPTURES);
+    }
+
+    end_start = std::min(end_start, earlier.end_start);
+  }
+
+  // loop frames are interned by each search, the frames of the earlier
+  // threads are interned again here
+  std::vector<uint32_t> frame_map(earlier.loops.size(), NO_LOOP);
+
+  auto map_frame = [&](auto &self, uint32_t loop) -> uint32_t {
+    if (loop == NO_LOOP) { return NO_LOOP; }
+
+    if (frame_map[loop] == NO_LOOP) {
+      auto &frame = earlier.loops[loop];
+      frame_map[loop] = push_loop(self(self, frame.parent), frame.count);
+    }
+
+    return frame_map[loop];
+  };
+
+  // a thread of this search in the state of an earlier thread has the
+  // same future with a later start, it is dropped
+  std::set<std::tuple<uint32_t, uint32_t, uint32_t>> carried{};
+
+  next.clear();
+
+  for (auto &thread : earlier.current) {
+    regex_assert(thread.start != NO_START);
+
+    auto loop = map_frame(map_frame, thread.loop);
+
+    carried.emplace(thread.edge, thread.progress, loop);
+    next.emplace_back(Thread{
+      .edge = thread.edge, .progress = thread.progress, .loop = loop,
+      .captures = NO_CAPTURES, .start = thread.start
+    });
+  }
+
+  for (auto &thread : current) {
+    if (!carried.contains({thread.edge, thread.progress, thread.loop})) {
+      next.push_back(thread);
+    }
+  }
+
+  std::swap(current, next);
+}
+
+bool Simulation::accept_any(std::string_view input) {
+  size_t offset = skip(input, 0);
+
+  start(offset);
+
+  while (!best_match && !current.empty() && offset < input.size()) {
+    // no match attempt is running, the next one starts at a byte which may
+    // begin a match
+    if (idle()) {
+      auto next_start = skip(input, offset);
+
+      if (next_start != offset) {
+        offset = next_start;
+        start(offset);
+        continue;
+      }
+    }
+
+    step(offset, input[offset]);
+    ++offset;
+  }
+
+  if (!best_match && offset == input.size()) { finish(offset); }
+
+  return best_match.has_value();
+}